@@ -0,0 +1,232 @@
+#include <sstream>
+
+#include "arraydisk.h"
+#include "flashdisk.h"
+
+
+ArrayDiskSystem::ArrayDiskSystem(const string &filestem) :
+  DiskSystem(filestem), lastblock(0)
+{
+  if (Configure()) {
+    throw GenericException();
+  }
+  try {
+    for (SIZE_T i=0;i<disks;i++) {
+      members.push_back(DiskSystem::Open(MemberName(filestem,i)));
+      if (!Fits(members[i]->GetNumBlocks())) {
+	throw GenericException();
+      }
+    }
+  } catch (GenericException &e) {
+    DeleteMembers();
+    throw;
+  }
+  memberrequests.assign(disks,0);
+  memberbusy.assign(disks,0);
+}
+
+ArrayDiskSystem::ArrayDiskSystem(const string &filestem,
+				 const SIZE_T blocks,
+				 const SIZE_T blocksize,
+				 const SIZE_T heads,
+				 const SIZE_T blockspertrack,
+				 const SIZE_T tracks,
+				 const double avgseek,
+				 const double trackseek,
+				 const double rotlat,
+				 const string &backend,
+				 const vector<pair<string, string> > &params,
+				 const string &membermodel,
+				 const vector<pair<string, string> > &memberparams) :
+  DiskSystem(filestem,true,0,blocks,blocksize,heads,blockspertrack,tracks,avgseek,trackseek,rotlat,backend),
+  lastblock(0)
+{
+  for (SIZE_T i=0;i<params.size();i++) {
+    if (!IsValidParam(params[i].first)) {
+      cerr << "Unknown array parameter "<<params[i].first<<".\n";
+      throw GenericException();
+    }
+  }
+  model="array";
+  modelparams=params;
+  if (Configure()) {
+    throw GenericException();
+  }
+  if ((tracks*copies)%disks) {
+    cerr << "The tracks can't be shared evenly among the disks.\n";
+    throw GenericException();
+  }
+
+  SIZE_T membertracks=tracks*copies/disks;
+  SIZE_T memberblocks=heads*blockspertrack*membertracks;
+
+  if (!Fits(memberblocks)) {
+    throw GenericException();
+  }
+  if (membermodel!="flash" && !(membermodel=="disk" && memberparams.empty())) {
+    cerr << "Members can't be of model "<<membermodel<<".\n";
+    throw GenericException();
+  }
+
+  // The members only model the times, so they are made with the ram
+  // backend, which keeps nothing but their configs
+  try {
+    for (SIZE_T i=0;i<disks;i++) {
+      if (membermodel=="flash") {
+	members.push_back(new FlashDiskSystem(MemberName(filestem,i),
+					      memberblocks,blocksize,heads,blockspertrack,membertracks,
+					      avgseek,trackseek,rotlat,"ram",memberparams));
+      } else {
+	members.push_back(new DiskSystem(MemberName(filestem,i),true,0,
+					 memberblocks,blocksize,heads,blockspertrack,membertracks,
+					 avgseek,trackseek,rotlat,"ram"));
+      }
+    }
+  } catch (GenericException &e) {
+    DeleteMembers();
+    throw;
+  }
+  memberrequests.assign(disks,0);
+  memberbusy.assign(disks,0);
+  // with the defaults filled in
+  WriteConfig();
+}
+
+ArrayDiskSystem::~ArrayDiskSystem()
+{
+  DeleteMembers();
+}
+
+void ArrayDiskSystem::DeleteMembers()
+{
+  for (SIZE_T i=0;i<members.size();i++) {
+    delete members[i];
+  }
+  members.clear();
+}
+
+
+ERROR_T ArrayDiskSystem::Configure()
+{
+  disks=(SIZE_T)GetModelParam("disks",2);
+  stripeunit=(SIZE_T)GetModelParam("stripeunit",16);
+  copies=(SIZE_T)GetModelParam("copies",1);
+
+  if (disks<1 || stripeunit<1 || copies<1 || disks%copies) {
+    cerr << "Impossible array parameters.\n";
+    return ERROR_BADCONFIG;
+  }
+  groups=disks/copies;
+
+  return ERROR_NOERROR;
+}
+
+
+bool ArrayDiskSystem::Fits(const SIZE_T memberblocks) const
+{
+  // The last stripe unit is the furthest into its member
+  SIZE_T last=GetNumBlocks()-1;
+
+  if ((last/stripeunit/groups)*stripeunit+last%stripeunit >= memberblocks) {
+    cerr << "The blocks don't fit on the disks in stripe units of "<<stripeunit<<".\n";
+    return false;
+  }
+  return true;
+}
+
+
+string ArrayDiskSystem::MemberName(const string &filestem, const SIZE_T i)
+{
+  ostringstream name;
+
+  name << filestem<<"."<<i;
+  return name.str();
+}
+
+bool ArrayDiskSystem::IsValidParam(const string &name)
+{
+  return name=="disks" || name=="stripeunit" || name=="copies";
+}
+
+void ArrayDiskSystem::PrintParams(ostream &os)
+{
+  os << "disks, stripeunit (in blocks), or copies (of each stripe unit)";
+}
+
+
+double ArrayDiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write)
+{
+  // The runs of member blocks each member is to serve, merged where
+  // they continue one another
+  vector<vector<pair<SIZE_T, SIZE_T> > > runs(disks);
+  vector<SIZE_T> load(disks,0);
+
+  for (SIZE_T b=offblock;b<offblock+numblock;) {
+    SIZE_T unit=b/stripeunit;
+    SIZE_T group=unit%groups;
+    SIZE_T start=(unit/groups)*stripeunit+b%stripeunit;
+    SIZE_T num=stripeunit-b%stripeunit;
+
+    if (num>offblock+numblock-b) {
+      num=offblock+numblock-b;
+    }
+
+    SIZE_T first=group*copies;
+    SIZE_T chosen=first;
+
+    if (!write) {
+      for (SIZE_T m=first+1;m<first+copies;m++) {
+	SIZE_T head=members[m]->GetHeadBlock();
+	SIZE_T best=members[chosen]->GetHeadBlock();
+	if (load[m]<load[chosen] ||
+	    (load[m]==load[chosen] &&
+	     (head>start ? head-start : start-head) < (best>start ? best-start : start-best))) {
+	  chosen=m;
+	}
+      }
+    }
+
+    for (SIZE_T m=first;m<first+copies;m++) {
+      if (!write && m!=chosen) {
+	continue;
+      }
+      if (!runs[m].empty() && runs[m].back().first+runs[m].back().second==start) {
+	runs[m].back().second+=num;
+      } else {
+	runs[m].push_back(pair<SIZE_T, SIZE_T>(start,num));
+      }
+      load[m]+=num;
+    }
+    b+=num;
+  }
+
+  double reqtime=0;
+
+  lastblock=offblock+numblock-1;
+  for (SIZE_T m=0;m<disks;m++) {
+    double busy=0;
+
+    for (SIZE_T i=0;i<runs[m].size();i++) {
+      busy+=members[m]->ModelAccess(runs[m][i].first,runs[m][i].second,write);
+    }
+    memberrequests[m]+=runs[m].size();
+    memberbusy[m]+=busy;
+    if (busy>reqtime) {
+      reqtime=busy;
+    }
+  }
+
+  return reqtime;
+}
+
+
+ostream & ArrayDiskSystem::PrintModelStats(ostream &os) const
+{
+  os << "model           = array"<<endl;
+  os << "arraydisks      = "<<disks<<" ("<<groups<<" groups of "<<copies<<", "<<stripeunit<<" block stripe units)"<<endl;
+  for (SIZE_T m=0;m<disks;m++) {
+    os << "member "<<m<<"        = "<<memberrequests[m]<<" requests, "<<memberbusy[m]<<" busy"<<endl;
+    members[m]->PrintModelStats(os);
+  }
+  return os;
+}
@@ -0,0 +1,85 @@
+#ifndef _arraydisk
+#define _arraydisk
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <utility>
+
+#include "global.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A disk made of an array of member disks, striped (RAID-0) and
+// optionally mirrored (RAID-10).  The array's blocks are cut into
+// stripe units of stripeunit blocks, which go round the disks/copies
+// mirror groups in turn, and each group keeps copies identical member
+// disks.  A write goes to every disk of its group; a read goes to the
+// disk of the group that has the least of the request so far, or
+// failing that whose head is nearest.
+//
+// The members are disks of their own, named filestem.0, filestem.1,
+// and so on, each with its own model (a rotating disk or flash) and
+// head, and they serve their parts of a request at the same time, so
+// the request takes as long as the busiest member.  They are made
+// with the ram backend, so their files only hold their configs (and a
+// flash member's FTL): the blocks themselves are kept in the array's
+// data file, and the array's bitmap is the one that counts.
+//
+class ArrayDiskSystem : public DiskSystem {
+ private:
+  SIZE_T disks;
+  SIZE_T stripeunit;
+  SIZE_T copies;
+  SIZE_T groups;
+  vector<DiskSystem *> members;
+  // The last block of the array the previous request touched
+  SIZE_T lastblock;
+
+  // Counted since the disk was opened
+  vector<double> memberrequests;
+  vector<double> memberbusy;
+
+  ERROR_T Configure();
+  void   DeleteMembers();
+  // Whether members of that many blocks hold the array
+  bool   Fits(const SIZE_T memberblocks) const;
+ protected:
+  double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+ public:
+  // Opens an existing array
+  ArrayDiskSystem(const string &filestem);
+  // Makes an array from disks members, each made with the geometry
+  // given but with its share of the tracks, which must divide evenly,
+  // and the model and model parameters given.  The array has as many
+  // blocks as the geometry says.
+  ArrayDiskSystem(const string &filestem,
+		  const SIZE_T blocks,
+		  const SIZE_T blocksize,
+		  const SIZE_T heads,
+		  const SIZE_T blockspertrack,
+		  const SIZE_T tracks,
+		  const double avgseek,
+		  const double trackseek,
+		  const double rotlat,
+		  const string &backend,
+		  const vector<pair<string, string> > &params,
+		  const string &membermodel,
+		  const vector<pair<string, string> > &memberparams);
+  ~ArrayDiskSystem();
+
+  SIZE_T GetNumMembers() const { return members.size(); }
+  const DiskSystem *GetMember(const SIZE_T i) const { return members[i]; }
+  SIZE_T GetHeadBlock() const { return lastblock; }
+  ostream & PrintModelStats(ostream &os) const;
+
+  // The name of member i of the array filestem
+  static string MemberName(const string &filestem, const SIZE_T i);
+  // disks, stripeunit, or copies
+  static bool IsValidParam(const string &name);
+  static void PrintParams(ostream &os);
+};
+
+#endif
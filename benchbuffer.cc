@@ -0,0 +1,145 @@
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+
+#include "buffercache.h"
+
+
+void usage()
+{
+  cerr << "usage: benchbuffer filestem cachesize maxthreads lookupsperthread [name=value ...]\n";
+  BufferCacheConfig::PrintUsage(cerr);
+}
+
+//
+// Measures lookup throughput of a shared buffer cache as the number
+// of threads grows.  The working set fits in the cache, so after the
+// warmup every lookup is a hit and the disk never gets in the way.
+//
+
+struct BenchThread {
+  BufferCache *cache;
+  SIZE_T       workingset;
+  SIZE_T       lookups;
+  unsigned int seed;
+  ERROR_T      rc;
+  pthread_t    thread;
+};
+
+static double Now()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+static void *Lookups(void *arg)
+{
+  BenchThread *t=(BenchThread *)arg;
+  unsigned long checksum=0;
+
+  t->rc=ERROR_NOERROR;
+  for (SIZE_T i=0;i<t->lookups;i++) {
+    BlockHandle handle;
+    SIZE_T blocknum=rand_r(&(t->seed)) % t->workingset;
+    ERROR_T rc=t->cache->PinBlock(blocknum,handle);
+    if (rc!=ERROR_NOERROR) {
+      t->rc=rc;
+      break;
+    }
+    checksum+=handle.GetData()[0];
+    handle.Unpin();
+  }
+  // keep the reads from being optimized away
+  t->seed^=checksum;
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc<5) {
+    usage();
+    exit(-1);
+  }
+  SIZE_T cachesize=atoi(argv[2]);
+  SIZE_T maxthreads=atoi(argv[3]);
+  SIZE_T lookups=atoi(argv[4]);
+  BufferCacheConfig config;
+
+  for (int i=5;i<argc;i++) {
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      exit(-1);
+    }
+  }
+
+  if (cachesize<1 || maxthreads<1) {
+    usage();
+    exit(-1);
+  }
+
+  OpenDisk disk(argv[1]);
+  BufferCache cache(disk,cachesize,config);
+
+  SIZE_T workingset = cachesize<disk->GetNumBlocks() ? cachesize : disk->GetNumBlocks();
+
+  cache.Attach();
+
+  // warm up the cache so that the runs below only measure hits
+  for (SIZE_T i=0;i<workingset;i++) {
+    Block block;
+    ERROR_T rc=cache.ReadBlock(i,block);
+    if (rc!=ERROR_NOERROR) {
+      cerr << "Error " << rc <<" occured when reading block "<< i << endl;
+      return -1;
+    }
+  }
+
+  cerr << "shards          = "<<cache.GetNumShards()<<endl;
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "workingset      = "<<workingset<<endl;
+  cerr << endl;
+
+  double base=0;
+
+  // 1, 2, 4, ... threads, finishing with maxthreads
+  for (SIZE_T n=1;n<=maxthreads;n = (n<maxthreads && 2*n>maxthreads) ? maxthreads : 2*n) {
+    vector<BenchThread> threads(n);
+
+    double start=Now();
+    for (SIZE_T i=0;i<n;i++) {
+      threads[i].cache=&cache;
+      threads[i].workingset=workingset;
+      threads[i].lookups=lookups;
+      threads[i].seed=i+1;
+      if (pthread_create(&(threads[i].thread),0,Lookups,&(threads[i]))) {
+	cerr << "Can't create thread\n";
+	return -1;
+      }
+    }
+    for (SIZE_T i=0;i<n;i++) {
+      pthread_join(threads[i].thread,0);
+      if (threads[i].rc!=ERROR_NOERROR) {
+	cerr << "Error " << threads[i].rc <<" occured during lookups"<< endl;
+	return -1;
+      }
+    }
+    double elapsed=Now()-start;
+    double rate=(double)n*lookups/elapsed;
+
+    if (n==1) {
+      base=rate;
+    }
+    cout << "threads = "<<n<<"  lookups/s = "<<rate<<"  speedup = "<<rate/base<<endl;
+  }
+
+  cache.Detach();
+
+  cerr << endl;
+  cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+
+  return 0;
+}
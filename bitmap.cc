@@ -0,0 +1,130 @@
+#include <string.h>
+#include <stdint.h>
+#include <endian.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitmap.h"
+
+// Word w of the map, in which the map's bit i is bit 63-(i%64) of word
+// i/64, so that the map's first bit is the most significant.  Bytes
+// past the end of the map read as zeros.
+static inline uint64_t Word(const BYTE_T *map, const size_t numbytes, const size_t w)
+{
+  size_t   at=w*8;
+  uint64_t x=0;
+
+  if (at+8<=numbytes) {
+    memcpy(&x,map+at,8);
+    return be64toh(x);
+  }
+  for (size_t i=0;i<8;i++) {
+    x<<=8;
+    if (at+i<numbytes) {
+      x|=map[at+i];
+    }
+  }
+  return x;
+}
+
+// The bits of a word from the b'th most significant on
+static inline uint64_t From(const size_t b)
+{
+  return b>=64 ? 0 : ~(uint64_t)0 >> b;
+}
+
+
+void SetBits(BYTE_T *map, const SIZE_T first, const SIZE_T num, const bool value)
+{
+  size_t i=first;
+  size_t end=(size_t)first+num;
+
+  for (;i<end && i%8;i++) {
+    if (value) {
+      map[i/8] |= 0x1 << (7-(i%8));
+    } else {
+      map[i/8] &= ~(0x1 << (7-(i%8)));
+    }
+  }
+  if (end-i>=8) {
+    memset(map+i/8,value ? 0xff : 0,(end-i)/8);
+    i+=(end-i)/8*8;
+  }
+  for (;i<end;i++) {
+    if (value) {
+      map[i/8] |= 0x1 << (7-(i%8));
+    } else {
+      map[i/8] &= ~(0x1 << (7-(i%8)));
+    }
+  }
+}
+
+
+SIZE_T CountBits(const BYTE_T *map, const SIZE_T first, const SIZE_T num)
+{
+  size_t end=(size_t)first+num;
+  size_t numbytes=(end+7)/8;
+  SIZE_T count=0;
+
+  for (size_t w=first/64;w*64<end;w++) {
+    size_t b = w*64<first ? first-w*64 : 0;
+    size_t e = end-w*64<64 ? end-w*64 : 64;
+    count+=__builtin_popcountll(Word(map,numbytes,w) & From(b) & ~From(e));
+  }
+  return count;
+}
+
+
+SIZE_T FindBit(const BYTE_T *map, const SIZE_T numbits, const SIZE_T from, const bool value)
+{
+  if (from>=numbits) {
+    return numbits;
+  }
+
+  size_t numbytes=((size_t)numbits+7)/8;
+  size_t numwords=((size_t)numbits+63)/64;
+  // Looking for clear bits is looking for set bits in the complement
+  uint64_t flip = value ? 0 : ~(uint64_t)0;
+  size_t w=from/64;
+  uint64_t x=(Word(map,numbytes,w)^flip) & From(from%64);
+
+  while (!x) {
+    if (++w>=numwords) {
+      return numbits;
+    }
+#ifdef __SSE2__
+    // Large stretches of a disk are all free or all allocated, so
+    // skip them sixteen bytes at a time
+    __m128i none=_mm_set1_epi8(value ? 0 : (char)0xff);
+    while (w*8+16<=numbytes &&
+	   _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(map+w*8)),none))==0xffff) {
+      w+=2;
+    }
+    if (w>=numwords) {
+      return numbits;
+    }
+#endif
+    x=Word(map,numbytes,w)^flip;
+  }
+
+  // the bytes past the end may have looked clear
+  size_t bit=w*64+__builtin_clzll(x);
+  return bit<numbits ? bit : numbits;
+}
+
+
+SIZE_T FindClearRun(const BYTE_T *map, const SIZE_T numbits, const SIZE_T num, const SIZE_T from)
+{
+  SIZE_T start=FindBit(map,numbits,from,false);
+
+  while (start<numbits && numbits-start>=num) {
+    SIZE_T end=FindBit(map,numbits,start,true);
+    if (end-start>=num) {
+      return start;
+    }
+    start=FindBit(map,numbits,end,false);
+  }
+  return numbits;
+}
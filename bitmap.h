@@ -0,0 +1,23 @@
+#ifndef _bitmap
+#define _bitmap
+
+#include "global.h"
+
+//
+// Operations on a bitmap of numbits bits held in bytes, most
+// significant bit first, as DiskSystem keeps its allocation bitmap:
+// bit i is bit 7-(i%8) of byte i/8.  They work a word (or, where the
+// compiler allows, a 16 byte vector) at a time rather than a bit at a
+// time.  The Find functions return numbits if there is no such bit.
+//
+
+// Sets or clears num bits from first
+void   SetBits(BYTE_T *map, const SIZE_T first, const SIZE_T num, const bool value);
+// How many of num bits from first are set
+SIZE_T CountBits(const BYTE_T *map, const SIZE_T first, const SIZE_T num);
+// The first set or clear bit at or after from
+SIZE_T FindBit(const BYTE_T *map, const SIZE_T numbits, const SIZE_T from, const bool value);
+// The first of num clear bits in a row at or after from
+SIZE_T FindClearRun(const BYTE_T *map, const SIZE_T numbits, const SIZE_T num, const SIZE_T from);
+
+#endif
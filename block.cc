@@ -40,6 +40,11 @@ Block::~Block()
 
 Block & Block::operator=(const Block &rhs)
 {
+  if (this==&rhs) { 
+    return *this;
+  }
+  // release our current data before reconstructing in place
+  this->Block::~Block();
   return *(new (this) Block(rhs));
 }
 
@@ -88,17 +93,37 @@ static char low2hex(BYTE_T x)
 
 #define MAX(x,y) ((x)>(y) ? (x) : (y))
 
+// Counted per thread, so that comparing stays free of shared writes
+static bool counting=false;
+static __thread SIZE_T comparisons=0;
+
 bool Block::operator<(const Block &rhs) const
 {
+  if (__atomic_load_n(&counting,__ATOMIC_RELAXED)) {
+    comparisons++;
+  }
   return memcmp(data,rhs.data,MAX(length,rhs.length))<0;
 }
 
 
 bool Block::operator==(const Block &rhs) const
 {
+  if (__atomic_load_n(&counting,__ATOMIC_RELAXED)) {
+    comparisons++;
+  }
   return memcmp(data,rhs.data,MAX(length,rhs.length))==0;
 }
 
+SIZE_T Block::GetNumComparisons()
+{
+  return comparisons;
+}
+
+void Block::CountComparisons()
+{
+  __atomic_store_n(&counting,true,__ATOMIC_RELAXED);
+}
+
 ostream & Block::Print(ostream &os) const
 {
   os << "Block(length="<<length<<", data=0x";
@@ -26,6 +26,10 @@ struct Block {
 
   bool operator<(const Block &rhs) const;
   bool operator==(const Block &rhs) const;
+  // Comparisons made so far by the calling thread, for cost
+  // accounting.  Nothing is counted until CountComparisons is called.
+  static SIZE_T GetNumComparisons();
+  static void   CountComparisons();
 
   ostream & Print(ostream &os) const;
 };
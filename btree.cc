@@ -118,6 +118,8 @@ ERROR_T BTreeIndex::Attach(const SIZE_T initblock, const bool create)
   superblock_index=initblock;
   assert(superblock_index==0);
 
+  NameBTreeNodeTags(buffercache);
+
   if (create) {
     // build a super block, root node, and a free space list
     //
@@ -195,8 +197,10 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
   SIZE_T offset;
   KEY_T testkey;
   SIZE_T ptr;
+  // pointer holds the path from the root down to node
+  SIZE_T depth = pointer.empty() ? 0 : pointer.size()-1;
 
-  rc= b.Unserialize(buffercache,node);
+  rc= b.Unserialize(buffercache,node,depth);
   SIZE_T rootPtr = superblock.info.rootnode;
   if(node==superblock.info.rootnode)
   {
@@ -250,7 +254,7 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node,
 	  // WRITE ME
     rc = b.SetVal(offset,value);
 	if (rc) { return rc; }
-	return b.Serialize(buffercache,node);
+	return b.Serialize(buffercache,node,depth);
 	}
       }
     }
@@ -584,7 +588,7 @@ ERROR_T BTreeIndex::split_Internal(vector<SIZE_T> &pointer,SIZE_T &new_blockptr_
     SIZE_T Address=pointer.back();
     pointer.pop_back();
     BTreeNode Temp_Node;
-    rc=Temp_Node.Unserialize(buffercache,Address);
+    rc=Temp_Node.Unserialize(buffercache,Address,pointer.size());
     if(Temp_Node.info.numkeys==Temp_Node.info.GetNumSlotsAsInterior()-1)
     {
         SIZE_T rootPtr = superblock.info.rootnode;
@@ -681,7 +685,7 @@ ERROR_T BTreeIndex::Insert(const KEY_T &key, const VALUE_T &value)
         SIZE_T Address=pointer.back();
         pointer.pop_back();
         BTreeNode Temp_Node;
-        rc=Temp_Node.Unserialize(buffercache,Address);
+        rc=Temp_Node.Unserialize(buffercache,Address,pointer.size());
         if(Temp_Node.info.numkeys==Temp_Node.info.GetNumSlotsAsLeaf()-1)
         {
         insert_Not_Full(Address,Temp_Node,key,value);
@@ -773,6 +777,13 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node,
   case BTREE_ROOT_NODE:
   case BTREE_INTERIOR_NODE:
     if (b.info.numkeys>0) {
+      // Start reading the children in the background while
+      // we walk the first ones.  It's fine if some don't fit.
+      for (offset=0;offset<=b.info.numkeys;offset++) {
+	rc=b.GetPtr(offset,ptr);
+	if (rc) { return rc; }
+	buffercache->PrefetchBlock(ptr);
+      }
       for (offset=0;offset<=b.info.numkeys;offset++) {
 	rc=b.GetPtr(offset,ptr);
 	if (rc) { return rc; }
@@ -806,7 +817,10 @@ ERROR_T BTreeIndex::Display(ostream &o, BTreeDisplayType display_type) const
   if (display_type==BTREE_DEPTH_DOT) {
     o << "digraph tree { \n";
   }
+  // every node is read once, so keep the hot nodes cached
+  buffercache->BeginScan();
   rc=DisplayInternal(superblock.info.rootnode,o,display_type);
+  buffercache->EndScan();
   if (display_type==BTREE_DEPTH_DOT) {
     o << "}\n";
   }
@@ -816,7 +830,9 @@ ERROR_T BTreeIndex::Display(ostream &o, BTreeDisplayType display_type) const
 
 ERROR_T BTreeIndex::SanityCheck() const
 {
+  buffercache->BeginScan();
   ERROR_T retCode = SanityWalk(superblock.info.rootnode);
+  buffercache->EndScan();
 return retCode;
 }
 ERROR_T BTreeIndex::SanityWalk(const SIZE_T &node) const
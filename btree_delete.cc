@@ -23,8 +23,8 @@ int main(int argc, char **argv)
   cachesize=atoi(argv[2]);
   key=argv[3];
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  OpenDisk disk(filestem);
+  BufferCache cache(disk,cachesize);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -1,5 +1,6 @@
 #include <new>
 #include <iostream>
+#include <sstream>
 #include <assert.h>
 #include <string.h>
 
@@ -95,48 +96,124 @@ BTreeNode & BTreeNode::operator=(const BTreeNode &rhs)
 }
 
 
-ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const
+static const int numnodetypes=BTREE_LEAF_NODE+1;
+
+SIZE_T BTreeNodeTag(const int nodetype, const SIZE_T depth)
+{
+  // 1.. by type alone, then by type and depth
+  if (depth==BTREE_UNKNOWN_DEPTH) {
+    return 1+nodetype;
+  }
+  return 1+numnodetypes+nodetype*(BTREE_MAX_TAGGED_DEPTH+1)
+    +(depth<BTREE_MAX_TAGGED_DEPTH ? depth : BTREE_MAX_TAGGED_DEPTH);
+}
+
+SIZE_T BTreeNodePriority(const int nodetype, const SIZE_T depth)
+{
+  switch (nodetype) {
+  case BTREE_SUPERBLOCK:
+    // every allocation and deallocation reads and writes it
+  case BTREE_ROOT_NODE:
+    return BufferCache::MAXPRIORITY;
+  case BTREE_INTERIOR_NODE:
+    // the root becomes an interior node once it has split
+    if (depth==BTREE_UNKNOWN_DEPTH || depth>=BufferCache::MAXPRIORITY) {
+      return 1;
+    }
+    return BufferCache::MAXPRIORITY-depth;
+  default:
+    return 0;
+  }
+}
+
+void NameBTreeNodeTags(BufferCache *b)
+{
+  const char *names[numnodetypes] = { "unallocated", "superblock", "root", "interior", "leaf" };
+
+  for (int t=0;t<numnodetypes;t++) {
+    b->SetTagName(BTreeNodeTag(t,BTREE_UNKNOWN_DEPTH),names[t]);
+    for (SIZE_T d=0;d<=BTREE_MAX_TAGGED_DEPTH;d++) {
+      ostringstream s;
+      s << names[t]<<"@"<<d<<(d==BTREE_MAX_TAGGED_DEPTH ? "+" : "");
+      b->SetTagName(BTreeNodeTag(t,d),s.str());
+    }
+  }
+}
+
+
+ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum, const SIZE_T depth) const
 {
   assert((unsigned)info.blocksize==b->GetBlockSize());
 
-  Block block(sizeof(info)+info.GetNumDataBytes());
+  // Write straight into the cached frame
+  BlockHandle block;
 
-  memcpy(block.data,&info,sizeof(info));
+  ERROR_T rc;
+
+  rc=b->PinBlock(blocknum,block,true);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  block.SetTag(BTreeNodeTag(info.nodetype,depth));
+  // An interior node written without its depth keeps the priority
+  // it was read with
+  if (info.nodetype!=BTREE_INTERIOR_NODE || depth!=BTREE_UNKNOWN_DEPTH) {
+    block.SetPriority(BTreeNodePriority(info.nodetype,depth));
+  }
+  memcpy(block.GetData(),&info,sizeof(info));
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) { 
-    memcpy(block.data+sizeof(info),data,info.GetNumDataBytes());
+    memcpy(block.GetData()+sizeof(info),data,info.GetNumDataBytes());
+    b->Charge(BufferCache::COST_COPY);
+  } else {
+    memset(block.GetData()+sizeof(info),0,info.GetNumDataBytes());
   }
 
-  return b->WriteBlock(blocknum,block);
+  return block.Unpin();
 }
 
 
-ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum)
+ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum, const SIZE_T depth)
 {
-  Block block;
+  // Copy straight out of the cached frame.  The node is changed and
+  // kept after the block is unpinned, so it needs its own copy, but
+  // a node that is read again keeps the buffer it already has.
+  BlockHandle block;
 
   ERROR_T rc;
 
-  rc=b->ReadBlock(blocknum,block);
+  rc=b->PinBlock(blocknum,block);
 
   if (rc!=ERROR_NOERROR) {
     return rc;
   }
 
-  memcpy(&info,block.data,sizeof(info));
-  
-  if (data) { 
-    delete [] data;
-    data=0;
-  }
+  SIZE_T oldbytes = data ? info.GetNumDataBytes() : 0;
 
+  memcpy(&info,block.GetData(),sizeof(info));
+  // now we know what we read
+  block.SetTag(BTreeNodeTag(info.nodetype,depth));
+  block.SetPriority(BTreeNodePriority(info.nodetype,depth));
+  
   assert(b->GetBlockSize()==(unsigned)info.blocksize);
 
   if (info.nodetype!=BTREE_UNALLOCATED_BLOCK && info.nodetype!=BTREE_SUPERBLOCK) {
-    data = new char [info.GetNumDataBytes()];
-    memcpy(data,block.data+sizeof(info),info.GetNumDataBytes());
+    if (data && oldbytes!=info.GetNumDataBytes()) {
+      delete [] data;
+      data=0;
+    }
+    if (!data) {
+      data = new char [info.GetNumDataBytes()];
+    }
+    memcpy(data,block.GetData()+sizeof(info),info.GetNumDataBytes());
+    b->Charge(BufferCache::COST_COPY);
+  } else if (data) {
+    delete [] data;
+    data=0;
   }
   
-  return ERROR_NOERROR;
+  return block.Unpin();
 }
 
 
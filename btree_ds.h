@@ -14,6 +14,11 @@ using namespace std;
 #define BTREE_INTERIOR_NODE 3
 #define BTREE_LEAF_NODE 4
 
+// Depth below the root, for when the caller doesn't know it
+#define BTREE_UNKNOWN_DEPTH ((SIZE_T)-1)
+// Deeper nodes share the statistics of this depth
+#define BTREE_MAX_TAGGED_DEPTH 7
+
 
 typedef Block Buffer;
 typedef Buffer KeyOrValue;
@@ -45,6 +50,18 @@ struct NodeMetadata {
 inline ostream & operator<< (ostream &os, const NodeMetadata &node) { return node.Print(os); }
 
 
+// Buffer cache tag for accesses to a node of the given type at
+// the given depth (the root is at depth 0)
+SIZE_T BTreeNodeTag(const int nodetype, const SIZE_T depth);
+// Gives the tags above readable names in the cache's statistics
+void   NameBTreeNodeTags(BufferCache *b);
+// Buffer cache retention priority for a node of the given type at
+// the given depth: the superblock and the root get the highest, then
+// interior nodes from the top down; leaves and free blocks get none.
+// The cache's retainlevels option keeps only the top levels.
+SIZE_T BTreeNodePriority(const int nodetype, const SIZE_T depth);
+
+
 
 //
 // Interior node:
@@ -78,8 +95,10 @@ struct BTreeNode {
   BTreeNode(const BTreeNode &rhs);
   BTreeNode & operator=(const BTreeNode &rhs);
   
-  ERROR_T Serialize(BufferCache *b, const SIZE_T block) const;
-  ERROR_T Unserialize(BufferCache *b, const SIZE_T block);
+  // The depth, if known, labels the access in the cache's statistics
+  // and sets the block's retention priority, see BTreeNodePriority
+  ERROR_T Serialize(BufferCache *b, const SIZE_T block, const SIZE_T depth=BTREE_UNKNOWN_DEPTH) const;
+  ERROR_T Unserialize(BufferCache *b, const SIZE_T block, const SIZE_T depth=BTREE_UNKNOWN_DEPTH);
 
   char *ResolveKey(const SIZE_T offset) const; // Gives a pointer to the ith key  (interior or leaf)
   char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior)
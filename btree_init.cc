@@ -24,8 +24,8 @@ int main(int argc, char **argv)
   keysize=atoi(argv[3]);
   valuesize=atoi(argv[4]);
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  OpenDisk disk(filestem);
+  BufferCache cache(disk,cachesize);
   BTreeIndex btree(keysize,valuesize,&cache);
   
   ERROR_T rc;
@@ -21,8 +21,8 @@ int main(int argc, char **argv)
   filestem=argv[1];
   cachesize=atoi(argv[2]);
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  OpenDisk disk(filestem);
+  BufferCache cache(disk,cachesize);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -24,8 +24,8 @@ int main(int argc, char **argv)
   key=argv[3];
   value=argv[4];
 
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  OpenDisk disk(filestem);
+  BufferCache cache(disk,cachesize);
   BTreeIndex btree(0,0,&cache);
   
   ERROR_T rc;
@@ -1,239 +1,2030 @@
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest()
-{
-  // In a real buffer cache, we would use a priority queue to make this O(1)
+const SIZE_T BufferCache::NOFRAME;
+
+
+static inline void Count(SIZE_T &counter, const SIZE_T n=1)
+{
+  __atomic_fetch_add(&counter,n,__ATOMIC_RELAXED);
+}
+
+static inline void AddTime(double &total, const double t)
+{
+  double old, sum;
+
+  __atomic_load(&total,&old,__ATOMIC_RELAXED);
+  do {
+    sum=old+t;
+  } while (!__atomic_compare_exchange(&total,&old,&sum,false,__ATOMIC_RELAXED,__ATOMIC_RELAXED));
+}
+
+
+//
+// Holds a shard's latch for the life of the object
+//
+class ShardLatch {
+ private:
+  pthread_mutex_t &latch;
+ public:
+  ShardLatch(BufferShard &shard) : latch(shard.latch) { pthread_mutex_lock(&latch); }
+  ~ShardLatch() { pthread_mutex_unlock(&latch); }
+};
+
+
+//
+// Frames that are pinned (or being prefetched into) can't be evicted,
+// and neither can those retained at priority keep or above
+//
+class UnpinnedFilter : public EvictionFilter {
+ private:
+  const vector<BufferFrame> &frames;
+  SIZE_T base, keep;
+ public:
+  UnpinnedFilter(const vector<BufferFrame> &f, const SIZE_T b, const SIZE_T k) : frames(f), base(b), keep(k) {}
+  bool CanEvict(const SIZE_T f) const { return frames[base+f].pincount==0 && frames[base+f].priority<keep; }
+};
+
+
+//
+// Dirty frames that nobody is using can be written back, except for
+// the one that was just written, which is about to be used again
+//
+class FlushFilter : public EvictionFilter {
+ private:
+  const vector<BufferFrame> &frames;
+  SIZE_T base, except;
+ public:
+  FlushFilter(const vector<BufferFrame> &f, const SIZE_T b, const SIZE_T e) : frames(f), base(b), except(e) {}
+  bool CanEvict(const SIZE_T f) const { return base+f!=except && frames[base+f].dirty && frames[base+f].pincount==0; }
+};
+
+
+static bool ParseCost(const string &val, double &cost)
+{
+  char *end;
+
+  cost=strtod(val.c_str(),&end);
+  return !val.empty() && !*end && cost>=0;
+}
+
+// Real time in milliseconds, the unit disks are usually made with
+static double WallTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec*1000.0+ts.tv_nsec/1000000.0;
+}
+
+// Kept per thread, so that operations running at once in different
+// threads aren't charged for each other's work: the real time spent
+// waiting for the disk with cpu=wall, and where the thread's current
+// operation started
+static __thread double threaddiskwall=0;
+static __thread double opstart=0, opdiskwallstart=0;
+static __thread SIZE_T opcomparisons=0;
+
+static bool ParseFraction(const string &val, double &frac)
+{
+  char *end;
+
+  frac=strtod(val.c_str(),&end);
+  return !val.empty() && !*end && frac>=0 && frac<=1;
+}
+
+
+BufferCacheConfig::BufferCacheConfig() : policy("lru"), shards(1), hugepages(false), dirtyhigh(1), dirtylow(0.25), readahead(32), retain(0.25), retainlevels(0), mrc(0), victim(0),
+  cpu("none"), hitcost(0.0005), comparecost(0.00005), copycost(0.001),
+  iodepth(1), ioengine("auto"), scheduler(""), trace("")
+{}
+
+ERROR_T BufferCacheConfig::Parse(const string &nameval)
+{
+  string::size_type eq=nameval.find('=');
+
+  if (eq==string::npos) {
+    return ERROR_GENERAL;
+  }
+
+  string name=nameval.substr(0,eq);
+  string val=nameval.substr(eq+1);
+
+  if (name=="policy") {
+    if (!ReplacementPolicy::IsValidName(val)) {
+      return ERROR_GENERAL;
+    }
+    policy=val;
+    return ERROR_NOERROR;
+  } else if (name=="shards") {
+    char *end;
+    unsigned long n=strtoul(val.c_str(),&end,10);
+    if (val.empty() || *end || n<1) {
+      return ERROR_GENERAL;
+    }
+    shards=n;
+    return ERROR_NOERROR;
+  } else if (name=="hugepages") {
+    if (val!="0" && val!="1") {
+      return ERROR_GENERAL;
+    }
+    hugepages = val=="1";
+    return ERROR_NOERROR;
+  } else if (name=="dirtyhigh") {
+    return ParseFraction(val,dirtyhigh) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="dirtylow") {
+    return ParseFraction(val,dirtylow) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="readahead") {
+    char *end;
+    unsigned long n=strtoul(val.c_str(),&end,10);
+    if (val.empty() || *end) {
+      return ERROR_GENERAL;
+    }
+    readahead=n;
+    return ERROR_NOERROR;
+  } else if (name=="retain") {
+    return ParseFraction(val,retain) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="retainlevels") {
+    char *end;
+    unsigned long n=strtoul(val.c_str(),&end,10);
+    if (val.empty() || *end || n>BufferCache::MAXPRIORITY) {
+      return ERROR_GENERAL;
+    }
+    retainlevels=n;
+    return ERROR_NOERROR;
+  } else if (name=="mrc") {
+    return ParseFraction(val,mrc) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="victim") {
+    char *end;
+    unsigned long n=strtoul(val.c_str(),&end,10);
+    if (val.empty() || *end) {
+      return ERROR_GENERAL;
+    }
+    victim=n;
+    return ERROR_NOERROR;
+  } else if (name=="cpu") {
+    if (val!="none" && val!="model" && val!="wall") {
+      return ERROR_GENERAL;
+    }
+    cpu=val;
+    return ERROR_NOERROR;
+  } else if (name=="hitcost") {
+    return ParseCost(val,hitcost) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="comparecost") {
+    return ParseCost(val,comparecost) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="copycost") {
+    return ParseCost(val,copycost) ? ERROR_NOERROR : ERROR_GENERAL;
+  } else if (name=="iodepth") {
+    char *end;
+    unsigned long n=strtoul(val.c_str(),&end,10);
+    if (val.empty() || *end || n<1) {
+      return ERROR_GENERAL;
+    }
+    iodepth=n;
+    return ERROR_NOERROR;
+  } else if (name=="scheduler") {
+    if (!DiskScheduler::IsValidName(val)) {
+      return ERROR_GENERAL;
+    }
+    scheduler=val;
+    return ERROR_NOERROR;
+  } else if (name=="ioengine") {
+    if (!DiskQueue::IsValidEngine(val)) {
+      return ERROR_GENERAL;
+    }
+    ioengine=val;
+    return ERROR_NOERROR;
+  } else if (name=="trace") {
+    if (val.empty()) {
+      return ERROR_GENERAL;
+    }
+    trace=val;
+    return ERROR_NOERROR;
+  } else {
+    return ERROR_GENERAL;
+  }
+}
+
+void BufferCacheConfig::PrintUsage(ostream &os)
+{
+  os << "buffer cache options (name=value):\n";
+  os << "  policy=P     replacement policy, one of ";
+  ReplacementPolicy::PrintNames(os);
+  os << " (default lru)\n";
+  os << "  shards=N     split the cache into N independently latched shards (default 1)\n";
+  os << "  hugepages=B  back the cache with huge pages if 1 (default 0)\n";
+  os << "  dirtyhigh=R  write back in the background once this fraction of the\n";
+  os << "               cache is dirty, 1 to never do so (default 1)\n";
+  os << "  dirtylow=R   until this fraction is dirty (default 0.25)\n";
+  os << "  readahead=N  read up to N blocks ahead of sequential readers, 0 for\n";
+  os << "               no read ahead (default 32)\n";
+  os << "  retain=R     keep blocks given a retention priority in up to this\n";
+  os << "               fraction of the cache (default 0.25)\n";
+  os << "  retainlevels=N  only honour the N highest priorities, which for a\n";
+  os << "               btree keeps the superblock and the top N levels, 0 for\n";
+  os << "               none (default 0, off)\n";
+  os << "  mrc=R        estimate a miss ratio curve by sampling this fraction\n";
+  os << "               of the blocks, 0 for none (default 0)\n";
+  os << "  victim=N     keep evicted blocks compressed in up to N blocks' worth\n";
+  os << "               of memory, 0 for none (default 0)\n";
+  os << "  cpu=M        charge CPU work to the simulated clock: none, model for\n";
+  os << "               the costs below, or wall for the real time of each\n";
+  os << "               operation (default none)\n";
+  os << "  hitcost=T    time per cache hit (default 0.0005)\n";
+  os << "  comparecost=T  time per key comparison (default 0.00005)\n";
+  os << "  copycost=T   time per block copied (default 0.001)\n";
+  os << "  iodepth=N    carry out up to N prefetches and write-backs at once on\n";
+  os << "               the real disk; the simulated one still does one at a\n";
+  os << "               time (default 1)\n";
+  os << "  ioengine=E   for iodepth above 1: uring, threads, or auto for uring\n";
+  os << "               where the kernel allows it (default auto)\n";
+  os << "  scheduler=S  let the disk order the prefetches and write-backs with\n";
+  os << "               scheduler S, one of ";
+  DiskScheduler::PrintNames(os);
+  os << "\n";
+  os << "               (default: the cache sweeps them upward itself)\n";
+  os << "  trace=FILE   record every block access and disk request in FILE,\n";
+  os << "               for tracereplay (default none)\n";
+}
+
+
+BufferShard & BufferCache::ShardOf(const SIZE_T blocknum)
+{
+  return shards[blocknum % shards.size()];
+}
+
+bool BufferCache::AllocateArena(const SIZE_T numframes)
+{
+  const size_t hugepagesize=2*1024*1024;
+  size_t len=(size_t)numframes*blocksize;
+
+  if (!config.hugepages) {
+    // mmap gives us page aligned memory that isn't touched until used
+    arenasize=len;
+    arena=(BYTE_T *)mmap(0,arenasize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (arena==MAP_FAILED) {
+      arena=0;
+      return false;
+    }
+    return true;
+  }
+
+  // Huge pages need huge page alignment, so map extra and trim
+  arenasize=(len+hugepagesize-1)/hugepagesize*hugepagesize;
+  BYTE_T *p=(BYTE_T *)mmap(0,arenasize+hugepagesize,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+  if (p==MAP_FAILED) {
+    arena=0;
+    return false;
+  }
+  size_t head=(hugepagesize-((size_t)p % hugepagesize)) % hugepagesize;
+  if (head>0) {
+    munmap(p,head);
+  }
+  munmap(p+head+arenasize,hugepagesize-head);
+  arena=p+head;
+#ifdef MADV_HUGEPAGE
+  // only advice - without transparent huge pages we still work
+  madvise(arena,arenasize,MADV_HUGEPAGE);
+#endif
+  return true;
+}
+
+void BufferCache::FreeArena()
+{
+  if (arena) {
+    munmap(arena,arenasize);
+    arena=0;
+    arenasize=0;
+  }
+}
+
+bool BufferCache::InScan() const
+{
+  return __atomic_load_n(&scandepth,__ATOMIC_RELAXED)>0;
+}
+
+void BufferCache::CountAccess(const SIZE_T tag, const bool hit, const double time)
+{
+  BufferTagStats &stats=tagstats[tag<MAXTAGS ? tag : MAXTAGS-1];
+
+  Count(hit ? stats.hits : stats.misses);
+  AddTime(stats.time,time);
+}
+
+void BufferCache::CountWriteback(const SIZE_T f)
+{
+  Count(tagstats[frames[f].tag].writebacks);
+}
+
+void BufferCache::SetPriority(BufferShard &shard, const SIZE_T f, const SIZE_T priority)
+{
+  // priorities below the ones honoured count as none
+  SIZE_T p = priority+config.retainlevels>MAXPRIORITY ? priority : 0;
+
+  shard.numretained[frames[f].priority]--;
+  frames[f].priority=p;
+  shard.numretained[p]++;
+}
+
+void BufferCache::SetDirty(BufferShard &shard, const SIZE_T f, const bool dirty)
+{
+  if (frames[f].dirty!=dirty) {
+    frames[f].dirty=dirty;
+    if (dirty) {
+      shard.numdirty++;
+    } else {
+      shard.numdirty--;
+    }
+  }
+}
+
+SIZE_T BufferCache::FindFrame(const BufferShard &shard, const SIZE_T blocknum) const
+{
+  SIZE_T f;
+
+  for (f=shard.buckets[(blocknum/shards.size()) & shard.bucketmask]; f!=NOFRAME; f=frames[f].hashnext) {
+    if (frames[f].blocknum==blocknum) {
+      return f;
+    }
+  }
+  return NOFRAME;
+}
+
+void BufferCache::HashInsert(BufferShard &shard, const SIZE_T f)
+{
+  SIZE_T b = (frames[f].blocknum/shards.size()) & shard.bucketmask;
+
+  frames[f].hashnext=shard.buckets[b];
+  shard.buckets[b]=f;
+}
+
+void BufferCache::HashRemove(BufferShard &shard, const SIZE_T f)
+{
+  SIZE_T *p = &(shard.buckets[(frames[f].blocknum/shards.size()) & shard.bucketmask]);
+
+  while (*p!=f) {
+    p=&(frames[*p].hashnext);
+  }
+  *p=frames[f].hashnext;
+  frames[f].hashnext=NOFRAME;
+}
+
+void BufferCache::GetCachedFrames(const BufferShard &shard, vector<SIZE_T> &cached) const
+{
+  for (SIZE_T b=0;b<shard.buckets.size();b++) {
+    for (SIZE_T f=shard.buckets[b]; f!=NOFRAME; f=frames[f].hashnext) {
+      cached.push_back(f);
+    }
+  }
+}
+
+void BufferCache::ResetFrames()
+{
+  // a cache size of zero still behaves as a single block cache
+  SIZE_T numframes = cachesize>0 ? cachesize : 1;
+  SIZE_T numshards = shards.size();
+
+  // no block number matches a stream that hasn't started
+  for (SIZE_T s=0;s<rastreams.size();s++) {
+    rastreams[s].next=NOFRAME;
+    rastreams[s].seen=0;
+    rastreams[s].window=0;
+    rastreams[s].end=NOFRAME;
+  }
+  ranext=0;
+
+  frames.clear();
+  frames.resize(numframes);
+
+  for (SIZE_T s=0;s<numshards;s++) {
+    BufferShard &shard=shards[s];
+    SIZE_T numbuckets=1;
+
+    // ShardOf deals blocks out round robin, so the first
+    // numframes%numshards shards get the extra frames
+    shard.base=s*(numframes/numshards)+(s<numframes%numshards ? s : numframes%numshards);
+    shard.numframes=numframes/numshards+(s<numframes%numshards ? 1 : 0);
+
+    while (numbuckets<2*shard.numframes) {
+      numbuckets<<=1;
+    }
+    shard.buckets.assign(numbuckets,NOFRAME);
+    shard.bucketmask=numbuckets-1;
+
+    for (SIZE_T i=shard.base;i<shard.base+shard.numframes;i++) {
+      frames[i].shard=s;
+      frames[i].hashnext = (i+1)<shard.base+shard.numframes ? i+1 : NOFRAME;
+      frames[i].pincount=0;
+      frames[i].dirty=false;
+      frames[i].inflight=false;
+      frames[i].flushing=false;
+      frames[i].prefetched=false;
+      frames[i].batched=false;
+      frames[i].readahead=false;
+      frames[i].tag=0;
+      frames[i].priority=0;
+      frames[i].inring=false;
+      frames[i].readytime=0;
+      frames[i].flushmark=0;
+    }
+    shard.freelist=shard.base;
+    delete shard.policy;
+    shard.policy=ReplacementPolicy::Create(config.policy,shard.numframes);
+    shard.scanring.Resize(shard.numframes);
+    shard.scanringsize = shard.numframes/4>0 ? shard.numframes/4 : 1;
+    shard.numcached=0;
+    shard.numprefetched=0;
+    shard.numinflight=0;
+    shard.numdirty=0;
+    shard.numretained.assign(MAXPRIORITY+1,0);
+    shard.numretained[0]=shard.numframes;
+    shard.iocompleted.clear();
+    shard.iofailed.clear();
+  }
+  pendingreads.clear();
+  pendingflush.clear();
+}
+
+void BufferCache::ChargeTime(const double t)
+{
+  pthread_mutex_lock(&disklock);
+  double now=curtime+t;
+  __atomic_store(&curtime,&now,__ATOMIC_RELAXED);
+  now=cputime+t;
+  __atomic_store(&cputime,&now,__ATOMIC_RELAXED);
+  pthread_mutex_unlock(&disklock);
+}
+
+void BufferCache::WaitUntil(const double t)
+{
+  pthread_mutex_lock(&disklock);
+  if (t>curtime) {
+    __atomic_store(&curtime,&t,__ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&disklock);
+}
+
+void BufferCache::IdleFlush(const double t)
+{
+  double idle=t-diskfreetime;
+  double owed=flushqueued-flushdone;
+
+  if (idle>0 && owed>0) {
+    double d = idle<owed ? idle : owed;
+    flushdone+=d;
+    diskfreetime+=d;
+  }
+}
+
+void BufferCache::WaitForFlush(const SIZE_T f)
+{
+  pthread_mutex_lock(&disklock);
+  IdleFlush(curtime);
+  if (frames[f].flushmark>flushdone) {
+    // the disk has nothing better to do than finish the write-backs
+    // up to this one, all of which we wait for
+    double start = diskfreetime>curtime ? diskfreetime : curtime;
+    double now=start+frames[f].flushmark-flushdone;
+    double stall=writebackstalltime+now-curtime;
+    flushdone=frames[f].flushmark;
+    diskfreetime=now;
+    __atomic_store(&curtime,&now,__ATOMIC_RELAXED);
+    __atomic_store(&writebackstalltime,&stall,__ATOMIC_RELAXED);
+    Count(writebackstalls);
+  }
+  pthread_mutex_unlock(&disklock);
+}
+
+
+void *BufferCache::IOWorkerMain(void *cache)
+{
+  ((BufferCache *)cache)->IOWorker();
+  return 0;
+}
+
+void BufferCache::IOWorker()
+{
+  pthread_mutex_lock(&iolock);
+  while (!ioshutdown) {
+    if (ioqueue.empty()) {
+      pthread_cond_wait(&iowork,&iolock);
+      continue;
+    }
+    // The runs stay at the front of the queue until they are done,
+    // so an empty queue means the disk is idle.  As many as the disk
+    // can take at once are started together, or all of them if the
+    // disk is to choose the order.
+    SIZE_T n=disk->GetQueueDepth();
+
+    if (n>ioqueue.size() || !config.scheduler.empty()) {
+      n=ioqueue.size();
+    }
+
+    vector<IORun *> batch(n);
+    vector<DiskRequest> reqs(n);
+    vector<DiskRequest *> submit(n), done;
+    vector<double> readytime(n);
+
+    for (SIZE_T i=0;i<n;i++) {
+      batch[i]=&ioqueue[i];
+    }
+    pthread_mutex_unlock(&iolock);
+
+    for (SIZE_T i=0;i<n;i++) {
+      IORun &run=*batch[i];
+      // the frames of a run aren't next to each other in the arena,
+      // so reads land in data first
+      if (!run.write) {
+	run.data.resize((size_t)run.frames.size()*blocksize);
+      }
+      reqs[i].write=run.write;
+      reqs[i].blocknum=run.blocknum;
+      reqs[i].numblocks=run.frames.size();
+      reqs[i].data=&(run.data[0]);
+      submit[i]=&reqs[i];
+    }
+
+    // The simulated disk takes the reads one after another, in the
+    // order its scheduler picks.  Write-backs are only owed, to be
+    // done in time the disk would otherwise be idle; readytime is
+    // then the flush mark of the run.
+    vector<SIZE_T> served(n);
+
+    pthread_mutex_lock(&disklock);
+    disk->Submit(submit);
+    for (SIZE_T i=0;i<n;i++) {
+      served[reqs[i].order]=i;
+    }
+    for (SIZE_T k=0;k<n;k++) {
+      SIZE_T i=served[k];
+      if (batch[i]->write) {
+	flushqueued+=reqs[i].reqtime;
+	readytime[i]=flushqueued;
+	continue;
+      }
+      IdleFlush(batch[i]->issuetime);
+      double start = batch[i]->issuetime>diskfreetime ? batch[i]->issuetime : diskfreetime;
+      diskfreetime=start+reqs[i].reqtime;
+      readytime[i]=diskfreetime;
+    }
+    pthread_mutex_unlock(&disklock);
+
+    disk->Complete(done,n);
+
+    for (SIZE_T i=0;i<n;i++) {
+      if (reqs[i].rc==ERROR_NOERROR && !batch[i]->write) {
+	// the frames are pinned and were sized when the prefetch was issued
+	for (SIZE_T j=0;j<batch[i]->frames.size();j++) {
+	  memcpy(FrameData(batch[i]->frames[j]),&(batch[i]->data[(size_t)j*blocksize]),blocksize);
+	}
+      }
+    }
+
+    pthread_mutex_lock(&iolock);
+    for (SIZE_T i=0;i<n;i++) {
+      IORun &run=*batch[i];
+      for (SIZE_T j=0;j<run.frames.size();j++) {
+	SIZE_T f=run.frames[j];
+	BufferShard &shard=shards[frames[f].shard];
+	if (run.write) {
+	  frames[f].flushmark=readytime[i];
+	} else {
+	  frames[f].readytime=readytime[i];
+	}
+	if (reqs[i].rc==ERROR_NOERROR) {
+	  shard.iocompleted.push_back(f);
+	} else {
+	  shard.iofailed.push_back(f);
+	}
+      }
+    }
+    ioqueue.erase(ioqueue.begin(),ioqueue.begin()+n);
+    pthread_cond_broadcast(&iodone);
+  }
+  pthread_mutex_unlock(&iolock);
+}
+
+bool BufferCache::StartIOWorker()
+{
+  bool ok=true;
+
+  pthread_mutex_lock(&iolock);
+  if (!ioworkerrunning) {
+    ioshutdown=false;
+    if (pthread_create(&ioworker,0,IOWorkerMain,this)) {
+      ok=false;
+    } else {
+      ioworkerrunning=true;
+    }
+  }
+  pthread_mutex_unlock(&iolock);
+  return ok;
+}
+
+void BufferCache::StopIOWorker()
+{
+  pthread_mutex_lock(&iolock);
+  if (!ioworkerrunning) {
+    pthread_mutex_unlock(&iolock);
+    return;
+  }
+  SubmitIO();
+  while (!ioqueue.empty()) {
+    pthread_cond_wait(&iodone,&iolock);
+  }
+  ioshutdown=true;
+  pthread_cond_signal(&iowork);
+  pthread_mutex_unlock(&iolock);
+
+  pthread_join(ioworker,0);
+
+  pthread_mutex_lock(&iolock);
+  ioworkerrunning=false;
+  pthread_mutex_unlock(&iolock);
+}
+
+static bool ByBlock(const IORun &lhs, const IORun &rhs)
+{
+  return lhs.blocknum<rhs.blocknum;
+}
+
+void BufferCache::SubmitIO()
+{
+  if (pendingreads.empty() && pendingflush.empty()) {
+    return;
+  }
+
+  // The disk will be wherever the last queued run leaves it
+  SIZE_T head;
+
+  if (!ioqueue.empty()) {
+    head=ioqueue.back().blocknum+ioqueue.back().frames.size()-1;
+  } else {
+    pthread_mutex_lock(&disklock);
+    head=disk->GetHeadBlock();
+    pthread_mutex_unlock(&disklock);
+  }
+
+  // Hand the worker write-backs in block order, with neighbours
+  // merged into one run
+  sort(pendingflush.begin(),pendingflush.end(),ByBlock);
+
+  SIZE_T firstwrite=ioqueue.size();
+  for (vector<IORun>::iterator i=pendingflush.begin(); i!=pendingflush.end(); ++i) {
+    if (ioqueue.size()==firstwrite ||
+	ioqueue.back().blocknum+ioqueue.back().frames.size()!=(*i).blocknum) {
+      ioqueue.push_back(IORun());
+      ioqueue.back().blocknum=(*i).blocknum;
+      ioqueue.back().write=true;
+      ioqueue.back().issuetime=GetCurrentTime();
+    }
+    IORun &run=ioqueue.back();
+    run.frames.insert(run.frames.end(),(*i).frames.begin(),(*i).frames.end());
+    run.data.insert(run.data.end(),(*i).data.begin(),(*i).data.end());
+  }
+  pendingflush.clear();
+  ElevatorOrder(firstwrite,head);
+
+  // and contiguous runs of reads
+  sort(pendingreads.begin(),pendingreads.end());
+
+  SIZE_T firstrun=ioqueue.size();
+  for (vector<pair<SIZE_T, SIZE_T> >::const_iterator i=pendingreads.begin();
+       i!=pendingreads.end();
+       ++i) {
+    if (ioqueue.size()==firstrun ||
+	ioqueue.back().blocknum+ioqueue.back().frames.size()!=(*i).first) {
+      IORun run;
+      run.blocknum=(*i).first;
+      run.write=false;
+      run.issuetime=GetCurrentTime();
+      ioqueue.push_back(run);
+    }
+    ioqueue.back().frames.push_back((*i).second);
+  }
+  pendingreads.clear();
+  ElevatorOrder(firstrun,head);
+
+  pthread_cond_signal(&iowork);
+}
+
+void BufferCache::ElevatorOrder(const SIZE_T firstrun, SIZE_T &head)
+{
+  // with a scheduler configured, the disk orders the runs itself
+  if (ioqueue.size()<=firstrun || !config.scheduler.empty()) {
+    return;
+  }
+
+  // The runs from firstrun on are in block order.  Going back
+  // against the rotation costs almost a full turn, so we only sweep
+  // upward: from the head, wrapping around to the lowest run, or
+  // from the lowest run if the head is closer to that end.
+  deque<IORun>::iterator begin=ioqueue.begin()+firstrun;
+  SIZE_T lowest=(*begin).blocknum;
+  SIZE_T highest=ioqueue.back().blocknum;
+
+  if (head>lowest && head<=highest && highest-head<head-lowest) {
+    deque<IORun>::iterator i=begin;
+    while ((*i).blocknum<head) {
+      ++i;
+    }
+    rotate(begin,i,ioqueue.end());
+  }
+  head=ioqueue.back().blocknum+ioqueue.back().frames.size()-1;
+}
+
+void BufferCache::WaitForIO(BufferShard &shard)
+{
+  double start = wallclock ? WallTime() : 0;
+
+  // If the worker isn't running, nothing can be queued
+  pthread_mutex_lock(&iolock);
+  SubmitIO();
+  while (!ioqueue.empty()) {
+    pthread_cond_wait(&iodone,&iolock);
+  }
+  pthread_mutex_unlock(&iolock);
+
+  if (wallclock) {
+    threaddiskwall+=WallTime()-start;
+  }
+
+  ReapIO(shard);
+}
+
+void BufferCache::ReapIO(BufferShard &shard)
+{
+  // keeps the common case off the shared iolock
+  if (shard.numinflight==0) {
+    return;
+  }
+
+  vector<SIZE_T> done, failed;
+
+  pthread_mutex_lock(&iolock);
+  done.swap(shard.iocompleted);
+  failed.swap(shard.iofailed);
+  pthread_mutex_unlock(&iolock);
+
+  for (vector<SIZE_T>::const_iterator i=done.begin(); i!=done.end(); ++i) {
+    frames[*i].pincount--;
+    shard.numinflight--;
+    if (frames[*i].flushing) {
+      frames[*i].flushing=false;
+      Count(diskwrites);
+    } else {
+      frames[*i].inflight=false;
+      Count(diskreads);
+    }
+  }
+  for (vector<SIZE_T>::const_iterator i=failed.begin(); i!=failed.end(); ++i) {
+    if (frames[*i].flushing) {
+      // the block still needs to be written
+      frames[*i].flushing=false;
+      frames[*i].pincount--;
+      shard.numinflight--;
+      Count(diskwrites);
+      SetDirty(shard,*i,true);
+      continue;
+    }
+    frames[*i].inflight=false;
+    frames[*i].pincount--;
+    shard.numinflight--;
+    Count(diskreads);
+    EvictFrame(shard,*i);
+  }
+}
+
+
+ERROR_T BufferCache::DiskRead(BufferShard &shard, const SIZE_T blocknum, BYTE_T *data)
+{
+  double reqtime;
+
+  // let earlier prefetches reach the disk first
+  WaitForIO(shard);
+
+  double start = wallclock ? WallTime() : 0;
+
+  pthread_mutex_lock(&disklock);
+  IdleFlush(curtime);
+  ERROR_T rc=disk->Read(blocknum,
+			1,
+			data,
+			reqtime);
+  // we may have to wait for the disk to finish prefetching
+  double now=(diskfreetime>curtime ? diskfreetime : curtime)+reqtime;
+  __atomic_store(&curtime,&now,__ATOMIC_RELAXED);
+  diskfreetime=now;
+  double readtime=readreqtime+reqtime;
+  __atomic_store(&readreqtime,&readtime,__ATOMIC_RELAXED);
+  pthread_mutex_unlock(&disklock);
+  if (wallclock) {
+    threaddiskwall+=WallTime()-start;
+  }
+  Count(diskreads);
+  return rc;
+}
+
+ERROR_T BufferCache::DiskWrite(BufferShard &shard, const SIZE_T blocknum, const SIZE_T numblocks, const BYTE_T *data)
+{
+  double reqtime;
+
+  WaitForIO(shard);
+
+  double start = wallclock ? WallTime() : 0;
+
+  pthread_mutex_lock(&disklock);
+  IdleFlush(curtime);
+  ERROR_T rc=disk->Write(blocknum,
+			 numblocks,
+			 data,
+			 reqtime);
+  double now=(diskfreetime>curtime ? diskfreetime : curtime)+reqtime;
+  __atomic_store(&curtime,&now,__ATOMIC_RELAXED);
+  diskfreetime=now;
+  pthread_mutex_unlock(&disklock);
+  if (wallclock) {
+    threaddiskwall+=WallTime()-start;
+  }
+  Count(diskwrites,numblocks);
+  return rc;
+}
+
+ERROR_T BufferCache::WriteRun(BufferShard &shard, const vector<SIZE_T> &run)
+{
+  ERROR_T rc;
+
+  if (run.size()==1) {
+    rc=DiskWrite(shard,frames[run[0]].blocknum,1,FrameData(run[0]));
+  } else {
+    // the frames aren't next to each other in the arena
+    vector<BYTE_T> buf((size_t)run.size()*blocksize);
+    for (SIZE_T i=0;i<run.size();i++) {
+      memcpy(&(buf[(size_t)i*blocksize]),FrameData(run[i]),blocksize);
+    }
+    rc=DiskWrite(shard,frames[run[0]].blocknum,run.size(),&(buf[0]));
+  }
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  for (vector<SIZE_T>::const_iterator i=run.begin(); i!=run.end(); ++i) {
+    SetDirty(shards[frames[*i].shard],*i,false);
+    CountWriteback(*i);
+  }
+  return ERROR_NOERROR;
+}
+
+void BufferCache::ClusterDirty(BufferShard &shard, const SIZE_T f, vector<SIZE_T> &run)
+{
+  SIZE_T first=frames[f].blocknum, last=frames[f].blocknum;
+  SIZE_T n;
+
+  run.clear();
+  // Neighbouring blocks belong to other shards, whose
+  // latches we don't hold
+  if (shards.size()==1) {
+    while (first>0 && (n=FindFrame(shard,first-1))!=NOFRAME &&
+	   frames[n].dirty && frames[n].pincount==0) {
+      first--;
+    }
+    while ((n=FindFrame(shard,last+1))!=NOFRAME &&
+	   frames[n].dirty && frames[n].pincount==0) {
+      last++;
+    }
+  }
+  for (SIZE_T b=first;b<=last;b++) {
+    run.push_back(b==frames[f].blocknum ? f : FindFrame(shard,b));
+  }
+}
+
+
+SIZE_T BufferCache::RetainedPriority(const BufferShard &shard) const
+{
+  SIZE_T share=(SIZE_T)(config.retain*shard.numframes);
+  SIZE_T total=0;
+
+  for (SIZE_T p=MAXPRIORITY;p>0;p--) {
+    total+=shard.numretained[p];
+    if (total>share) {
+      return p+1;
+    }
+  }
+  return 1;
+}
+
+SIZE_T BufferCache::FindVictim(BufferShard &shard, const SIZE_T blocknum, const bool peek)
+{
+  SIZE_T keep=RetainedPriority(shard);
+  SIZE_T f=NOFRAME;
+
+  // Retained frames are given up only if everything else is pinned
+  for (;;) {
+    UnpinnedFilter filter(frames,shard.base,keep);
+
+    // Scanned blocks go first, unless a scan is still filling the ring
+    if (shard.scanring.Size()>0 && (!InScan() || shard.scanring.Size()>=shard.scanringsize)) {
+      f=shard.scanring.FindVictim(filter);
+    }
+    if (f==NOFRAME) {
+      f = peek ? shard.policy->Peek(blocknum,filter) : shard.policy->Victim(blocknum,filter);
+    }
+    if (f==NOFRAME) {
+      f=shard.scanring.FindVictim(filter);
+    }
+    if (f!=NOFRAME || keep>MAXPRIORITY) {
+      break;
+    }
+    keep=MAXPRIORITY+1;
+  }
+  return f==NOFRAME ? NOFRAME : shard.base+f;
+}
+
+ERROR_T BufferCache::CheckDeleteOldest(BufferShard &shard, const SIZE_T blocknum)
+{
+  // Only delete if the cache is full
+  if (shard.freelist!=NOFRAME) {
+    return ERROR_NOERROR;
+  }
+
+  SIZE_T f=FindVictim(shard,blocknum);
+
+  if ((f==NOFRAME || frames[f].dirty) && shard.numinflight>0) {
+    // the frames being prefetched or written back will be
+    // free (and clean) shortly
+    WaitForIO(shard);
+    f=FindVictim(shard,blocknum);
+  }
+
+  if (f==NOFRAME) {
+    return ERROR_NOERROR;
+  }
+
+  // its last write-back may not have reached the disk yet
+  WaitForFlush(f);
+
+  // write it, and any dirty neighbours while we're at it,
+  // and delete it
+  if (frames[f].dirty) {
+    double start=GetCurrentTime();
+    vector<SIZE_T> run;
+    ClusterDirty(shard,f,run);
+    ERROR_T rc=WriteRun(shard,run);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    Count(writebackstalls);
+    pthread_mutex_lock(&disklock);
+    double stall=writebackstalltime+curtime-start;
+    __atomic_store(&writebackstalltime,&stall,__ATOMIC_RELAXED);
+    pthread_mutex_unlock(&disklock);
+  }
+  Count(tagstats[frames[f].tag].evictions);
+  if (victims) {
+    victims->Insert(frames[f].blocknum,FrameData(f));
+  }
+  EvictFrame(shard,f);
+  return ERROR_NOERROR;
+}
+
+void BufferCache::CheckFlush(BufferShard &shard, const SIZE_T written)
+{
+  if (shard.numdirty<=config.dirtyhigh*shard.numframes) {
+    return;
+  }
+
+  SIZE_T low=(SIZE_T)(config.dirtylow*shard.numframes);
+  FlushFilter filter(frames,shard.base,written);
+  vector<SIZE_T> cold;
+
+  if (!StartIOWorker()) {
+    return;
+  }
+
+  // Clean in eviction order, so the next victims are clean ones
+  if (shard.scanring.Size()>0) {
+    shard.scanring.Coldest(shard.numdirty-low,filter,cold);
+  }
+  shard.policy->Coldest(shard.numdirty-low,filter,cold);
+
+  pthread_mutex_lock(&iolock);
+  for (vector<SIZE_T>::const_iterator i=cold.begin(); i!=cold.end(); ++i) {
+    SIZE_T f=shard.base+*i;
+    BYTE_T *data=FrameData(f);
+
+    // The frame stays pinned, so it can't be evicted before
+    // it is on disk.  If it is written again meanwhile it just
+    // becomes dirty again.
+    pendingflush.push_back(IORun());
+    pendingflush.back().blocknum=frames[f].blocknum;
+    pendingflush.back().frames.push_back(f);
+    pendingflush.back().data.assign(data,data+blocksize);
+    frames[f].flushing=true;
+    frames[f].pincount++;
+    SetDirty(shard,f,false);
+    CountWriteback(f);
+    shard.numinflight++;
+    Count(flushes);
+  }
+  // hand them over now rather than with the next miss, which would
+  // otherwise wait behind them
+  SubmitIO();
+  pthread_mutex_unlock(&iolock);
+}
+
+ERROR_T BufferCache::GetFreeFrame(BufferShard &shard, const SIZE_T blocknum, SIZE_T &f)
+{
+  ERROR_T rc=CheckDeleteOldest(shard,blocknum);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  if (shard.freelist==NOFRAME) {
+    return ERROR_NOSPACE;
+  }
+  f=shard.freelist;
+  shard.freelist=frames[f].hashnext;
+  frames[f].hashnext=NOFRAME;
+  return ERROR_NOERROR;
+}
+
+void BufferCache::AdmitFrame(BufferShard &shard, const SIZE_T f)
+{
+  if (InScan()) {
+    shard.scanring.PushFront(f-shard.base);
+    frames[f].inring=true;
+  } else {
+    shard.policy->Admit(f-shard.base,frames[f].blocknum);
+  }
+}
+
+void BufferCache::TouchFrame(BufferShard &shard, const SIZE_T f)
+{
+  bool scanning=InScan();
+
+  if (frames[f].inring) {
+    shard.scanring.Unlink(f-shard.base);
+    if (scanning) {
+      shard.scanring.PushFront(f-shard.base);
+    } else {
+      // used again outside the scan, so it is worth keeping
+      frames[f].inring=false;
+      shard.policy->Admit(f-shard.base,frames[f].blocknum);
+    }
+  } else if (!scanning) {
+    shard.policy->Touch(f-shard.base,frames[f].blocknum);
+  }
+}
+
+void BufferCache::EvictFrame(BufferShard &shard, const SIZE_T f)
+{
+  if (frames[f].inring) {
+    shard.scanring.Unlink(f-shard.base);
+    frames[f].inring=false;
+  } else {
+    shard.policy->Remove(f-shard.base,frames[f].blocknum);
+  }
+  HashRemove(shard,f);
+  ReleaseFrame(shard,f);
+}
+
+void BufferCache::ReleaseFrame(BufferShard &shard, const SIZE_T f)
+{
+  if (frames[f].prefetched) {
+    frames[f].prefetched=false;
+    shard.numprefetched--;
+    Count(prefetchwasted);
+  }
+  if (frames[f].readahead) {
+    frames[f].readahead=false;
+    shard.numprefetched--;
+    Count(readaheadwasted);
+  }
+  frames[f].batched=false;
+  SetDirty(shard,f,false);
+  SetPriority(shard,f,0);
+  frames[f].hashnext=shard.freelist;
+  shard.freelist=f;
+  shard.numcached--;
+}
+
+ERROR_T BufferCache::LookupFrame(BufferShard &shard, const SIZE_T blocknum, const bool fetch, SIZE_T &f, bool &hit, bool &ahead)
+{
+  ReapIO(shard);
+
+  if (misscurve) {
+    misscurve->Access(blocknum,fetch);
+  }
+
+  f=FindFrame(shard,blocknum);
+
+  if (f!=NOFRAME && frames[f].inflight) {
+    // wait for the prefetch, which may fail and release the frame
+    WaitForIO(shard);
+    f=FindFrame(shard,blocknum);
+  }
+
+  hit = f!=NOFRAME && !frames[f].batched;
+  if (hit) {
+    Cost(COST_HIT);
+  }
+  // blocks read for a ReadBlocks batch count as misses, but the
+  // batch already covers them, so only a real miss reads ahead
+  ahead = fetch && config.readahead>0 && f==NOFRAME;
+
+  if (f!=NOFRAME) {
+    if (frames[f].batched) {
+      // the policy was told when the read was queued
+      WaitUntil(frames[f].readytime);
+      frames[f].batched=false;
+    } else {
+      if (frames[f].prefetched) {
+	// we only stall for the part of the read that hasn't finished
+	WaitUntil(frames[f].readytime);
+	frames[f].prefetched=false;
+	shard.numprefetched--;
+	Count(prefetchhits);
+      }
+      if (frames[f].readahead) {
+	WaitUntil(frames[f].readytime);
+	frames[f].readahead=false;
+	shard.numprefetched--;
+	Count(readaheadhits);
+	// the reader is catching up with what has been read ahead
+	ahead = config.readahead>0;
+      }
+      TouchFrame(shard,f);
+    }
+  } else {
+    // It's not in cache, so time to allocate it
+    double start=GetCurrentTime();
+    ERROR_T rc=GetFreeFrame(shard,blocknum,f);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    if (!(IsBlockAllocated(blocknum))) {
+      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+	cerr << "BufferCache: Attempt to "<<(fetch ? "read" : "write")<<" unallocated block " << blocknum << endl;
+      }
+    }
+    if (fetch && victims && victims->Take(blocknum,FrameData(f))) {
+      // it was in the compressed tier, and unpacking it is about
+      // as much work as copying a block
+      Cost(COST_COPY);
+    } else if (fetch) {
+      // read it from disk straight into the frame
+      rc=DiskRead(shard,blocknum,FrameData(f));
+      Count(readmisses);
+      AddTime(readmisstime,GetCurrentTime()-start);
+    } else if (victims) {
+      // the compressed copy is about to be stale
+      victims->Take(blocknum,0);
+    }
+    if (rc!=ERROR_NOERROR) {
+      frames[f].hashnext=shard.freelist;
+      shard.freelist=f;
+      return rc;
+    }
+    frames[f].blocknum=blocknum;
+    HashInsert(shard,f);
+    AdmitFrame(shard,f);
+    shard.numcached++;
+  }
+
+  return ERROR_NOERROR;
+}
+
+
+BufferCache::BufferCache(DiskSystem *d,
+			 SIZE_T cs,
+			 const BufferCacheConfig &cfg) : 
+   disk(d), cachesize(cs), blocksize(d->GetBlockSize()), arena(0), arenasize(0), config(cfg), olddepth(1), scandepth(0), curtime(0), diskfreetime(0),
+   allocs(0), deallocs(0), reads(0), writes(0),
+   diskreads(0), diskwrites(0),
+   prefetches(0), prefetchhits(0), prefetchwasted(0),
+   flushes(0), writebackstalls(0), writebackstalltime(0), flushqueued(0), flushdone(0),
+   tagstats(MAXTAGS), tagnames(MAXTAGS),
+   readaheads(0), readaheadhits(0), readaheadwasted(0), rastreams(NUMSTREAMS), ranext(0), misscurve(0), readmisses(0), readmisstime(0), victims(0), readreqtime(0),
+   costs(NUMCOSTEVENTS), wallclock(false), cputime(0), trace(0),
+   ioworkerrunning(false), ioshutdown(false)
+{
+  // Check everything that can be checked before touching anything,
+  // so that a bad configuration leaves nothing behind
+  if (!ReplacementPolicy::IsValidName(config.policy) || config.shards<1 ||
+      config.dirtylow>config.dirtyhigh || config.iodepth<1 ||
+      !DiskQueue::IsValidEngine(config.ioengine) ||
+      (!config.scheduler.empty() && !DiskScheduler::IsValidName(config.scheduler))) {
+    throw GenericException();
+  }
+
+  // every shard needs at least one frame
+  SIZE_T numframes = cachesize>0 ? cachesize : 1;
+
+  // Then the steps that can still fail, each undoing the ones
+  // before it if it does
+  if (!config.trace.empty()) {
+    trace=new TraceWriter(config.trace);
+  }
+  if (!AllocateArena(numframes)) {
+    delete trace;
+    throw GenericException();
+  }
+
+  olddepth=disk->GetQueueDepth();
+  oldengine = olddepth>1 ? disk->GetQueueEngine() : "auto";
+  oldscheduler=disk->GetScheduler()->GetName();
+
+  // a failure leaves the disk's old queue in place
+  if (disk->SetQueueDepth(config.iodepth,config.ioengine)!=ERROR_NOERROR) {
+    FreeArena();
+    delete trace;
+    throw GenericException();
+  }
+  if (!config.scheduler.empty() && disk->SetScheduler(config.scheduler)!=ERROR_NOERROR) {
+    disk->SetQueueDepth(olddepth,oldengine);
+    FreeArena();
+    delete trace;
+    throw GenericException();
+  }
+
+  pthread_mutex_init(&iolock,0);
+  pthread_mutex_init(&disklock,0);
+  pthread_mutex_init(&ralock,0);
+  pthread_cond_init(&iowork,0);
+  pthread_cond_init(&iodone,0);
+
+  tagnames[0]="untagged";
+
+  if (config.mrc>0) {
+    misscurve=new MissRatioCurve(config.mrc);
+  }
+  if (config.victim>0) {
+    victims=new VictimCache(config.victim*blocksize,blocksize);
+  }
+  if (config.cpu=="model") {
+    costs[COST_HIT]=config.hitcost;
+    costs[COST_COMPARE]=config.comparecost;
+    costs[COST_COPY]=config.copycost;
+  }
+  wallclock = config.cpu=="wall";
+  if (config.cpu=="model" || trace) {
+    // for the cost model here or in a replay of the trace
+    Block::CountComparisons();
+  }
+
+  shards.resize(config.shards<numframes ? config.shards : numframes);
+  for (SIZE_T s=0;s<shards.size();s++) {
+    pthread_mutex_init(&(shards[s].latch),0);
+    shards[s].policy=0;
+  }
+  ResetFrames();
+
+  if (trace) {
+    disk->SetTrace(trace);
+  }
+}
+
+
+BufferCache::~BufferCache()
+{
+  if (disk) { 
+    Detach();
+  }
+  StopIOWorker();
+  if (disk) {
+    disk->SetQueueDepth(olddepth,oldengine);
+    disk->SetScheduler(oldscheduler);
+  }
+  if (trace) {
+    disk->SetTrace(0);
+    delete trace;
+    trace=0;
+  }
+  for (SIZE_T s=0;s<shards.size();s++) {
+    delete shards[s].policy;
+    shards[s].policy=0;
+    pthread_mutex_destroy(&(shards[s].latch));
+  }
+  FreeArena();
+  delete misscurve;
+  misscurve=0;
+  delete victims;
+  victims=0;
+  pthread_cond_destroy(&iodone);
+  pthread_cond_destroy(&iowork);
+  pthread_mutex_destroy(&ralock);
+  pthread_mutex_destroy(&disklock);
+  pthread_mutex_destroy(&iolock);
+  disk=0; cachesize=0; curtime=0;
+}
+
+ERROR_T BufferCache::Attach()
+{
+  StopIOWorker();
+  ResetFrames();
+  if (trace) {
+    trace->Record(TRACE_ATTACH,0,0,GetCurrentTime(),GetCurrentTime());
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::Detach()
+{
+  double start=GetCurrentTime();
+
+  // finish any prefetches and write-backs before tearing things down
+  StopIOWorker();
+  pthread_mutex_lock(&disklock);
+  IdleFlush(curtime);
+  // and whatever write-back is still owed is done now
+  diskfreetime+=flushqueued-flushdone;
+  flushdone=flushqueued;
+  if (diskfreetime>curtime) {
+    __atomic_store(&curtime,&diskfreetime,__ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&disklock);
+
+  // write out all of our data and then throw it away
+  // in block order, one request per run of consecutive blocks
+
+  vector<pair<SIZE_T, SIZE_T> > dirtyframes;
+
+  for (SIZE_T s=0;s<shards.size();s++) {
+    ShardLatch latch(shards[s]);
+    vector<SIZE_T> cached;
+
+    ReapIO(shards[s]);
+    GetCachedFrames(shards[s],cached);
+
+    for (vector<SIZE_T>::const_iterator f=cached.begin(); f!=cached.end(); ++f) {
+      if (frames[*f].dirty) {
+	dirtyframes.push_back(pair<SIZE_T, SIZE_T>(frames[*f].blocknum,*f));
+      }
+    }
+  }
+
+  sort(dirtyframes.begin(),dirtyframes.end());
+
+  // Nobody else may use the cache during Detach, so a run
+  // can span shards without holding their latches
+  vector<SIZE_T> run;
+
+  for (SIZE_T i=0;i<dirtyframes.size();i++) {
+    run.push_back(dirtyframes[i].second);
+    if (i+1==dirtyframes.size() || dirtyframes[i+1].first!=dirtyframes[i].first+1) {
+      ERROR_T rc=WriteRun(shards[frames[run[0]].shard],run);
+      if (rc!=ERROR_NOERROR) {
+	return rc;
+      }
+      run.clear();
+    }
+  }
+  ResetFrames();
+  if (victims) {
+    victims->Clear();
+  }
+  if (trace) {
+    trace->Record(TRACE_DETACH,0,0,start,GetCurrentTime());
+  }
+  // a mapped disk only has what we wrote in memory so far
+  return disk->Sync();
+}
+
+
+SIZE_T BufferCache::GetCacheSize() const
+{
+  return cachesize;
+}
+
+
+SIZE_T BufferCache::GetBlockSize() const
+{
+  return disk->GetBlockSize();
+}
+
+SIZE_T BufferCache::GetNumBlocks() const
+{
+  return disk->GetNumBlocks();
+}
+
+double BufferCache::GetCurrentTime() const
+{
+  double t;
+
+  __atomic_load(&curtime,&t,__ATOMIC_RELAXED);
+  return t;
+}
+
+double BufferCache::GetWritebackStallTime() const
+{
+  double t;
+
+  __atomic_load(&writebackstalltime,&t,__ATOMIC_RELAXED);
+  return t;
+}
+
+ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
+{
+  Count(allocs);
+  if (trace) {
+    trace->Record(TRACE_ALLOCATE,outblocknum,1,GetCurrentTime(),GetCurrentTime());
+  }
+  pthread_mutex_lock(&disklock);
+  ERROR_T rc=disk->NotifyAllocateBlocks(outblocknum,1);
+  pthread_mutex_unlock(&disklock);
+  return rc;
+}
+
+ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
+{
+  Count(deallocs);
+  if (trace) {
+    trace->Record(TRACE_DEALLOCATE,inblocknum,1,GetCurrentTime(),GetCurrentTime());
+  }
+  pthread_mutex_lock(&disklock);
+  ERROR_T rc=disk->NotifyDeallocateBlocks(inblocknum,1);
+  pthread_mutex_unlock(&disklock);
+  return rc;
+}
+
+
+bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
+{
+  pthread_mutex_lock(&disklock);
+  bool rc=disk->IsBlockAllocated(inblocknum);
+  pthread_mutex_unlock(&disklock);
+  return rc;
+}
+
+
+ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+{
+  BufferShard &shard=ShardOf(inblocknum);
+  bool ahead;
+
+  {
+    ShardLatch latch(shard);
+    double start=GetCurrentTime();
+    SIZE_T f;
+    bool hit;
+
+    ERROR_T rc=LookupFrame(shard,inblocknum,true,f,hit,ahead);
+
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+    frames[f].tag=0;
+    CountAccess(0,hit,GetCurrentTime()-start);
+    if (outblock.length!=blocksize && outblock.Resize(blocksize,false)!=ERROR_NOERROR) {
+      return ERROR_NOMEM;
+    }
+    memcpy(outblock.data,FrameData(f),blocksize);
+    Cost(COST_COPY);
+    outblock.dirty=frames[f].dirty;
+    outblock.lastaccessed=GetCurrentTime();
+    Count(reads);
+    if (trace) {
+      trace->Record(TRACE_READ,inblocknum,1,start,GetCurrentTime(),hit ? TRACE_HIT : 0);
+    }
+  }
+  // the blocks ahead live in other shards, so our latch must be gone
+  if (ahead) {
+    ReadAhead(inblocknum);
+  }
+  return ERROR_NOERROR;
+} 
+ 
+ERROR_T BufferCache::ReadBlocks(const vector<SIZE_T> &blocknums, vector<Block> &outblocks)
+{
+  for (SIZE_T i=0;i<blocknums.size();i++) {
+    if (blocknums[i]>=GetNumBlocks()) {
+      return ERROR_NOSUCHBLOCK;
+    }
+  }
+
+  // the reads that follow are the batch's
+  if (trace) {
+    trace->Record(TRACE_READBATCH,blocknums.empty() ? 0 : blocknums[0],blocknums.size(),
+		  GetCurrentTime(),GetCurrentTime());
+  }
+
+  // Queue all the misses before waiting for any of them, so the
+  // worker gets them together
+  for (SIZE_T i=0;i<blocknums.size();i++) {
+    BufferShard &shard=ShardOf(blocknums[i]);
+    ShardLatch latch(shard);
+    SIZE_T f;
+
+    ReapIO(shard);
+    if (FindFrame(shard,blocknums[i])!=NOFRAME) {
+      continue;
+    }
+    if (!(IsBlockAllocated(blocknums[i]))) {
+      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
+	cerr << "BufferCache: Attempt to read unallocated block " << blocknums[i] << endl;
+      }
+    }
+    // Once the batch fills the shard, the rest is left for ReadBlock
+    // to read on its own, rather than pushing out blocks that we
+    // have queued but not used yet
+    if (shard.freelist==NOFRAME) {
+      SIZE_T victim=FindVictim(shard,blocknums[i],true);
+      if (victim==NOFRAME || frames[victim].batched) {
+	continue;
+      }
+    }
+    if (QueueRead(shard,blocknums[i],f)==ERROR_NOERROR) {
+      frames[f].batched=true;
+    }
+  }
 
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr=blockmap.end();
-  double oldest = curtime+1;
+  outblocks.resize(blocknums.size());
 
-  // Only delete if the cache is full
-  if (blockmap.size() < cachesize) {
-    return ERROR_NOERROR;
+  for (SIZE_T i=0;i<blocknums.size();i++) {
+    ERROR_T rc=ReadBlock(blocknums[i],outblocks[i]);
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+  }
+  return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
+{
+  if (inblock.length!=blocksize) {
+    return ERROR_WRONGSIZEBLOCK;
   }
 
-  // Find oldest
+  BufferShard &shard=ShardOf(inblocknum);
+  ShardLatch latch(shard);
+  double start=GetCurrentTime();
+  SIZE_T f;
+  bool hit, ahead;
+  
+  ERROR_T rc=LookupFrame(shard,inblocknum,false,f,hit,ahead);
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-       if ((*i).second.lastaccessed<oldest) { 
-	 oldestptr=i;
-	 oldest=(*i).second.lastaccessed;
-       }
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+  frames[f].tag=0;
+  CountAccess(0,hit,GetCurrentTime()-start);
+  memcpy(FrameData(f),inblock.data,blocksize);
+  Cost(COST_COPY);
+  SetDirty(shard,f,true);
+  Count(writes);
+  CheckFlush(shard,f);
+  if (trace) {
+    trace->Record(TRACE_WRITE,inblocknum,1,start,GetCurrentTime(),hit ? TRACE_HIT : 0);
   }
+  return ERROR_NOERROR;
+}
   
-  // write and delete it if it exists
- 
-  if (oldestptr!=blockmap.end()) { 
-    if ((*oldestptr).second.dirty) {
-      double reqtime;
-      int rc=disk->Write((*oldestptr).first,
-			 (*oldestptr).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
+ERROR_T BufferCache::PinBlock(const SIZE_T blocknum, BlockHandle &handle, const bool overwrite)
+{
+  if (handle.IsPinned()) {
+    return ERROR_ALREADY;
+  }
+
+  BufferShard &shard=ShardOf(blocknum);
+  bool ahead;
+
+  {
+    ShardLatch latch(shard);
+    double start=GetCurrentTime();
+    SIZE_T f;
+    bool hit;
+
+    ERROR_T rc=LookupFrame(shard,blocknum,!overwrite,f,hit,ahead);
+
+    if (rc!=ERROR_NOERROR) {
+      return rc;
+    }
+
+    frames[f].pincount++;
+
+    // the access is counted against the handle's tag when it is unpinned
+    handle.cache=this;
+    handle.frame=f;
+    handle.tag=0;
+    handle.priority=frames[f].priority;
+    handle.hit=hit;
+    handle.time=GetCurrentTime()-start;
+
+    if (overwrite) {
+      SetDirty(shard,f,true);
+      Count(writes);
+      CheckFlush(shard,f);
+    } else {
+      Count(reads);
+    }
+    if (trace) {
+      trace->Record(TRACE_PIN,blocknum,1,start,GetCurrentTime(),
+		    (hit ? TRACE_HIT : 0) | (overwrite ? TRACE_OVERWRITE : 0));
     }
-    blockmap.erase(oldestptr);
+  }
+  if (ahead) {
+    ReadAhead(blocknum);
   }
   return ERROR_NOERROR;
 }
 
-BufferCache::BufferCache(DiskSystem *d,
-			 SIZE_T cs) : 
-   disk(d), cachesize(cs), curtime(0),
-   allocs(0), deallocs(0), reads(0), writes(0),
-   diskreads(0), diskwrites(0)
-{}
+ERROR_T BufferCache::MarkDirty(BlockHandle &handle)
+{
+  if (handle.cache!=this) {
+    return ERROR_GENERAL;
+  }
+  BufferShard &shard=shards[frames[handle.frame].shard];
+  ShardLatch latch(shard);
+  SetDirty(shard,handle.frame,true);
+  Count(writes);
+  CheckFlush(shard,handle.frame);
+  if (trace) {
+    trace->Record(TRACE_DIRTY,frames[handle.frame].blocknum,1,GetCurrentTime(),GetCurrentTime());
+  }
+  return ERROR_NOERROR;
+}
 
+ERROR_T BufferCache::UnpinBlock(BlockHandle &handle)
+{
+  if (handle.cache!=this) {
+    return ERROR_GENERAL;
+  }
+  ShardLatch latch(shards[frames[handle.frame].shard]);
+  frames[handle.frame].pincount--;
+  frames[handle.frame].tag = handle.tag<MAXTAGS ? handle.tag : MAXTAGS-1;
+  SetPriority(shards[frames[handle.frame].shard],handle.frame,handle.priority);
+  CountAccess(handle.tag,handle.hit,handle.time);
+  if (trace) {
+    trace->Record(TRACE_UNPIN,frames[handle.frame].blocknum,1,GetCurrentTime(),GetCurrentTime(),
+		  0,frames[handle.frame].tag,handle.priority);
+  }
+  handle.cache=0;
+  handle.frame=0;
+  return ERROR_NOERROR;
+}
 
-BufferCache::~BufferCache()
+ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
 {
-  if (disk) { 
-    Detach();
+  if (blocknum>=GetNumBlocks()) {
+    return ERROR_NOSUCHBLOCK;
   }
-  disk=0; cachesize=0; curtime=0;
+  if (trace) {
+    trace->Record(TRACE_PREFETCH,blocknum,1,GetCurrentTime(),GetCurrentTime());
+  }
+
+  BufferShard &shard=ShardOf(blocknum);
+  ShardLatch latch(shard);
+
+  ReapIO(shard);
+
+  if (FindFrame(shard,blocknum)!=NOFRAME) {
+    // already here or on its way
+    return ERROR_NOERROR;
+  }
+
+  SIZE_T f;
+
+  if (!CanReadEarly(shard,blocknum) || QueueRead(shard,blocknum,f)!=ERROR_NOERROR) {
+    return ERROR_NOFETCH;
+  }
+  frames[f].prefetched=true;
+  shard.numprefetched++;
+  Count(prefetches);
+
+  return ERROR_NOERROR;
 }
 
-ERROR_T BufferCache::Attach()
+bool BufferCache::CanReadEarly(BufferShard &shard, const SIZE_T blocknum)
+{
+  // Don't let speculative blocks crowd out the working set
+  SIZE_T maxprefetched = shard.numframes/4>0 ? shard.numframes/4 : 1;
+
+  if (shard.numprefetched>=maxprefetched) {
+    return false;
+  }
+
+  // Writing back a dirty victim would stall us, defeating the purpose,
+  // and a block queued for ReadBlocks is about to be used
+  if (shard.freelist==NOFRAME) {
+    SIZE_T victim=FindVictim(shard,blocknum,true);
+    if (victim==NOFRAME || frames[victim].dirty || frames[victim].batched) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BufferCache::ReadAhead(const SIZE_T blocknum)
+{
+  SIZE_T first, last;
+
+  pthread_mutex_lock(&ralock);
+
+  SIZE_T s;
+
+  // A stream continues with its next block, or with one it has
+  // read ahead that was already cached and so went unnoticed
+  for (s=0;s<rastreams.size();s++) {
+    ReadAheadStream &st=rastreams[s];
+    if (blocknum>=st.next && (blocknum==st.next || (st.end!=NOFRAME && blocknum<=st.end+1))) {
+      break;
+    }
+  }
+
+  if (s==rastreams.size()) {
+    // a new stream takes the place of the oldest one
+    ReadAheadStream &st=rastreams[ranext];
+    ranext=(ranext+1)%rastreams.size();
+    st.next=blocknum+1;
+    st.seen=1;
+    st.window=0;
+    st.end=blocknum;
+    pthread_mutex_unlock(&ralock);
+    return;
+  }
+
+  ReadAheadStream &st=rastreams[s];
+
+  st.next=blocknum+1;
+  st.seen++;
+
+  // Wait until a few blocks in a row make it look sequential, and
+  // then until the reader is halfway through the last window
+  if (st.seen<RASTART || blocknum+st.window/2<st.end) {
+    pthread_mutex_unlock(&ralock);
+    return;
+  }
+  st.window = st.window>0 ? 2*st.window : 4;
+  if (st.window>config.readahead) {
+    st.window=config.readahead;
+  }
+  first = st.end>blocknum ? st.end+1 : blocknum+1;
+  last = first+st.window-1;
+  if (last>=GetNumBlocks()) {
+    last=GetNumBlocks()-1;
+  }
+  st.end=last;
+
+  pthread_mutex_unlock(&ralock);
+
+  // The worker merges these into one read per run of blocks
+  for (SIZE_T b=first;b<=last;b++) {
+    BufferShard &shard=ShardOf(b);
+    ShardLatch latch(shard);
+    SIZE_T f;
+
+    ReapIO(shard);
+    if (FindFrame(shard,b)!=NOFRAME) {
+      continue;
+    }
+    // the stream has run off the end of the data
+    if (!IsBlockAllocated(b)) {
+      break;
+    }
+    if (!CanReadEarly(shard,b) || QueueRead(shard,b,f)!=ERROR_NOERROR) {
+      continue;
+    }
+    frames[f].readahead=true;
+    shard.numprefetched++;
+    Count(readaheads);
+  }
+}
+
+ERROR_T BufferCache::QueueRead(BufferShard &shard, const SIZE_T blocknum, SIZE_T &f)
 {
-  blockmap.clear();
+  if (!StartIOWorker()) {
+    return ERROR_GENERAL;
+  }
+
+  ERROR_T rc=GetFreeFrame(shard,blocknum,f);
+
+  if (rc!=ERROR_NOERROR) {
+    return rc;
+  }
+
+  if (victims && victims->Take(blocknum,FrameData(f))) {
+    // no need to read it at all, only to unpack it
+    Cost(COST_COPY);
+    frames[f].blocknum=blocknum;
+    frames[f].readytime=GetCurrentTime();
+    HashInsert(shard,f);
+    AdmitFrame(shard,f);
+    shard.numcached++;
+    return ERROR_NOERROR;
+  }
+
+  // The frame stays pinned until the worker has filled it
+  frames[f].blocknum=blocknum;
+  frames[f].inflight=true;
+  frames[f].pincount++;
+  HashInsert(shard,f);
+  AdmitFrame(shard,f);
+  shard.numcached++;
+  shard.numinflight++;
+
+  // Handed to the worker, together with any others issued
+  // before it, at the next foreground operation
+  pthread_mutex_lock(&iolock);
+  pendingreads.push_back(pair<SIZE_T, SIZE_T>(blocknum,f));
+  pthread_mutex_unlock(&iolock);
+
   return ERROR_NOERROR;
 }
+  
+void BufferCache::BeginScan()
+{
+  if (trace) {
+    trace->Record(TRACE_BEGINSCAN,0,0,GetCurrentTime(),GetCurrentTime());
+  }
+  __atomic_fetch_add(&scandepth,1,__ATOMIC_RELAXED);
+}
 
-ERROR_T BufferCache::Detach()
+void BufferCache::EndScan()
 {
-  // write out all of our data and then throw it away
+  if (trace) {
+    trace->Record(TRACE_ENDSCAN,0,0,GetCurrentTime(),GetCurrentTime());
+  }
+  SIZE_T depth=__atomic_load_n(&scandepth,__ATOMIC_RELAXED);
 
-  for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i=blockmap.begin();
-	 i!=blockmap.end();
-	 ++i) {
-    if ((*i).second.dirty) { 
-      double reqtime;
-      int rc=disk->Write((*i).first,
-			 (*i).second,
-			 reqtime);
-      curtime+=reqtime;
-      diskwrites++;
+  while (depth>0 &&
+	 !__atomic_compare_exchange_n(&scandepth,&depth,depth-1,false,
+				      __ATOMIC_RELAXED,__ATOMIC_RELAXED)) {
+  }
+}
+
+ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
+{
+  if (trace) {
+    trace->Record(TRACE_FLUSH,blocknum,1,GetCurrentTime(),GetCurrentTime());
+  }
+
+  BufferShard &shard=ShardOf(blocknum);
+  ShardLatch latch(shard);
+
+  ReapIO(shard);
+
+  SIZE_T f=FindFrame(shard,blocknum);
+
+  if (f!=NOFRAME && (frames[f].inflight || frames[f].flushing)) {
+    WaitForIO(shard);
+    f=FindFrame(shard,blocknum);
+  }
+  
+  if (f==NOFRAME) {
+    return ERROR_NOERROR;
+  } else {
+    WaitForFlush(f);
+    if (frames[f].dirty) {
+      ERROR_T rc=DiskWrite(shard,frames[f].blocknum,1,FrameData(f));
       if (rc!=ERROR_NOERROR) { 
 	return rc;
       }
+      SetDirty(shard,f,false);
+      CountWriteback(f);
     }
+    if (frames[f].pincount==0) {
+      EvictFrame(shard,f);
+    }
+    return ERROR_NOERROR;
   }
-  blockmap.clear();
-  return ERROR_NOERROR;
 }
+  
 
-
-SIZE_T BufferCache::GetCacheSize() const
+BlockHandle::~BlockHandle()
 {
-  return cachesize;
+  if (cache) {
+    Unpin();
+  }
 }
 
-
-SIZE_T BufferCache::GetBlockSize() const
+BYTE_T * BlockHandle::GetData() const
 {
-  return disk->GetBlockSize();
+  return cache ? cache->FrameData(frame) : 0;
 }
 
-SIZE_T BufferCache::GetNumBlocks() const
+SIZE_T BlockHandle::GetLength() const
 {
-  return disk->GetNumBlocks();
+  return cache ? cache->blocksize : 0;
 }
 
-double BufferCache::GetCurrentTime() const
+SIZE_T BlockHandle::GetBlockNum() const
 {
-  return curtime;
+  return cache ? cache->frames[frame].blocknum : 0;
 }
 
-ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum)
+ERROR_T BlockHandle::MarkDirty()
 {
-  allocs++;
-  return disk->NotifyAllocateBlocks(outblocknum,1);
+  return cache ? cache->MarkDirty(*this) : ERROR_GENERAL;
 }
 
-ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum)
+ERROR_T BlockHandle::SetTag(const SIZE_T t)
 {
-  deallocs++;
-  return disk->NotifyDeallocateBlocks(inblocknum,1);
+  if (!cache) {
+    return ERROR_GENERAL;
+  }
+  tag=t;
+  return ERROR_NOERROR;
 }
 
+ERROR_T BlockHandle::SetPriority(const SIZE_T p)
+{
+  if (!cache) {
+    return ERROR_GENERAL;
+  }
+  priority = p<BufferCache::MAXPRIORITY ? p : BufferCache::MAXPRIORITY;
+  return ERROR_NOERROR;
+}
 
-bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum)
+ERROR_T BlockHandle::Unpin()
 {
-  return disk->IsBlockAllocated(inblocknum);
+  return cache ? cache->UnpinBlock(*this) : ERROR_GENERAL;
 }
 
 
-ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) 
+void BufferCache::SetTagName(const SIZE_T tag, const string &name)
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-
-  b = blockmap.find(inblocknum);
+  tagnames[tag<MAXTAGS ? tag : MAXTAGS-1]=name;
+}
 
-  if (b!=blockmap.end()) {
-    // It's in  cache, just update its lastaccessed and return it
-    outblock=(*b).second;
-    (*b).second.lastaccessed=curtime;
-    reads++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    // read it from disk
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum<<endl;
-      }
-    }
-    double reqtime;
-    int rc = disk->Read(inblocknum,
-			outblock,
-			reqtime);
-    curtime+=reqtime;
-    diskreads++;
-    if (rc!=ERROR_NOERROR) { 
-      return rc;
-    } else {
-      outblock.lastaccessed=curtime;
-      outblock.dirty=false;
-      blockmap[inblocknum]=outblock;
-      reads++;
-      return ERROR_NOERROR;
-    }
-  }
-} 
- 
-ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock)
+string BufferCache::GetTagName(const SIZE_T tag) const
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(inblocknum);
-
-  if (b!=blockmap.end()) {
-    // It's in  cache, so just replace the block
-    (*b).second=inblock;
-    (*b).second.lastaccessed=curtime;
-    (*b).second.dirty=true;
-    writes++;
-    return ERROR_NOERROR;
-  } else {
-    // It's not in cache, so time to allocate it
-    CheckDeleteOldest();
-    if (!(disk->IsBlockAllocated(inblocknum))) { 
-      if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-	cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
-      }
-    }
-    Block myblock=inblock;
-    myblock.lastaccessed=curtime;
-    myblock.dirty=true;
-    blockmap[inblocknum]=myblock;
-    writes++;
-    return ERROR_NOERROR;
+  SIZE_T t = tag<MAXTAGS ? tag : MAXTAGS-1;
+
+  if (tagnames[t].empty()) {
+    ostringstream s;
+    s << "tag"<<t;
+    return s.str();
   }
+  return tagnames[t];
 }
-  
-ERROR_T BufferCache::PrefetchBlock (const SIZE_T blocknum)
+
+BufferTagStats BufferCache::GetTagStats(const SIZE_T tag) const
 {
-  // Not implemented yet
-  return ERROR_IMPLBUG;
+  const BufferTagStats &stats=tagstats[tag<MAXTAGS ? tag : MAXTAGS-1];
+  BufferTagStats s;
+
+  s.hits=__atomic_load_n(&stats.hits,__ATOMIC_RELAXED);
+  s.misses=__atomic_load_n(&stats.misses,__ATOMIC_RELAXED);
+  s.evictions=__atomic_load_n(&stats.evictions,__ATOMIC_RELAXED);
+  s.writebacks=__atomic_load_n(&stats.writebacks,__ATOMIC_RELAXED);
+  __atomic_load(&stats.time,&s.time,__ATOMIC_RELAXED);
+  return s;
 }
-  
-ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum)
+
+ostream & BufferCache::PrintTagStats(ostream &os, const bool json) const
 {
-  map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
-  
-  b = blockmap.find(blocknum);
+  bool first=true;
 
-  if (b==blockmap.end()) { 
-    return ERROR_NOERROR;
+  if (json) {
+    os << "[";
   } else {
-    if ((*b).second.dirty) { 
-      double reqtime;
-      int rc;
-      rc=disk->Write((*b).first,
-		     (*b).second,
-		     reqtime);
-      diskwrites++;
-      curtime+=reqtime;
-      if (rc!=ERROR_NOERROR) { 
-	return rc;
-      }
+    os << setw(16) << left << "tag" << right
+       << setw(10) << "hits"
+       << setw(10) << "misses"
+       << setw(10) << "evictions"
+       << setw(11) << "writebacks"
+       << setw(12) << "time" << endl;
+  }
+  for (SIZE_T t=0;t<MAXTAGS;t++) {
+    BufferTagStats s=GetTagStats(t);
+
+    if (s.hits+s.misses+s.evictions+s.writebacks==0) {
+      continue;
     }
-    blockmap.erase(b);
-    return ERROR_NOERROR;
+    if (json) {
+      os << (first ? "\n" : ",\n")
+	 << "  {\"tag\": \""<<GetTagName(t)<<"\", \"hits\": "<<s.hits
+	 << ", \"misses\": "<<s.misses<<", \"evictions\": "<<s.evictions
+	 << ", \"writebacks\": "<<s.writebacks<<", \"time\": "<<s.time<<"}";
+    } else {
+      os << setw(16) << left << GetTagName(t) << right
+	 << setw(10) << s.hits
+	 << setw(10) << s.misses
+	 << setw(10) << s.evictions
+	 << setw(11) << s.writebacks
+	 << setw(12) << s.time << endl;
+    }
+    first=false;
   }
+  if (json) {
+    os << "\n]\n";
+  }
+  return os;
 }
-  
+
+
 ostream & BufferCache::Print(ostream &os) const
 {
   os << "BufferCache(cachesize="<<cachesize
      << ", blocksize="<<GetBlockSize()
-     << ", curtime="<<curtime
+     << ", curtime="<<GetCurrentTime()
      << ", allocs="<<allocs
      << ", deallocs="<<deallocs
      << ", reads="<<reads
@@ -242,17 +2033,137 @@ ostream & BufferCache::Print(ostream &os) const
      << ", diskwrites="<<diskwrites
      << ", blocks = {";
 
+  // print in block order
+  vector<SIZE_T> cachedframes;
+  vector<pair<SIZE_T, bool> > cached;
+
+  for (SIZE_T s=0;s<shards.size();s++) {
+    GetCachedFrames(shards[s],cachedframes);
+  }
   
-  for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b=blockmap.begin(); 
-       b!=blockmap.end(); 
+  for (vector<SIZE_T>::const_iterator f=cachedframes.begin(); f!=cachedframes.end(); ++f) {
+    cached.push_back(pair<SIZE_T, bool>(frames[*f].blocknum,frames[*f].dirty));
+  }
+
+  sort(cached.begin(),cached.end());
+
+  for (vector<pair<SIZE_T, bool> >::const_iterator b=cached.begin();
+       b!=cached.end();
        ++b) {
-    if (b!=blockmap.begin()) { 
+    if (b!=cached.begin()) {
       os << ", ";
     }
-    os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+    os << (*b).first << ((*b).second ? "(dirty)" : "");
   }
   os << "}, disk="<<*disk<<")";
   
   return os;
 }
   
+
+ostream & BufferCache::PrintMissRatioCurve(ostream &os) const
+{
+  if (!misscurve) {
+    return os;
+  }
+
+  SIZE_T misses=__atomic_load_n(&readmisses,__ATOMIC_RELAXED);
+  double misstime;
+
+  __atomic_load(&readmisstime,&misstime,__ATOMIC_RELAXED);
+
+  double misscost = misses>0 ? misstime/misses : 0;
+  double accesses = misscurve->GetNumAccesses();
+  // the rest of the time doesn't depend on the cache size
+  double fixed = GetCurrentTime()-misstime;
+  vector<SIZE_T> sizes;
+
+  for (SIZE_T s=1;;s*=2) {
+    sizes.push_back(s);
+    if (s>=misscurve->GetNumBlocks()) {
+      break;
+    }
+  }
+  sizes.push_back(cachesize);
+  sort(sizes.begin(),sizes.end());
+  sizes.erase(unique(sizes.begin(),sizes.end()),sizes.end());
+
+  os << setw(12) << "cachesize"
+     << setw(12) << "missratio"
+     << setw(12) << "misses"
+     << setw(14) << "time" << endl;
+  for (SIZE_T i=0;i<sizes.size();i++) {
+    double ratio=misscurve->MissRatio(sizes[i]);
+    os << setw(12) << sizes[i]
+       << setw(12) << ratio
+       << setw(12) << (SIZE_T)(ratio*accesses+0.5)
+       << setw(14) << fixed+ratio*accesses*misscost
+       << (sizes[i]==cachesize ? "  (this run)" : "") << endl;
+  }
+  return os;
+}
+
+double BufferCache::GetVictimSavedTime() const
+{
+  if (!victims) {
+    return 0;
+  }
+
+  SIZE_T misses=__atomic_load_n(&readmisses,__ATOMIC_RELAXED);
+
+  double readtime;
+
+  __atomic_load(&readreqtime,&readtime,__ATOMIC_RELAXED);
+  return misses>0 ? victims->GetNumHits()*readtime/misses : 0;
+}
+
+void BufferCache::Charge(const CostEvent event, const SIZE_T count)
+{
+  if (trace) {
+    trace->Record(TRACE_CHARGE,0,count,GetCurrentTime(),GetCurrentTime(),0,event);
+  }
+  Cost(event,count);
+}
+
+void BufferCache::Cost(const CostEvent event, const SIZE_T count)
+{
+  if (costs[event]>0 && count>0) {
+    ChargeTime(costs[event]*count);
+  }
+}
+
+void BufferCache::BeginOperation()
+{
+  if (trace) {
+    trace->BeginOperation(GetCurrentTime());
+  }
+  opcomparisons=Block::GetNumComparisons();
+  if (wallclock) {
+    opdiskwallstart=threaddiskwall;
+    opstart=WallTime();
+  }
+}
+
+void BufferCache::EndOperation()
+{
+  SIZE_T comparisons=Block::GetNumComparisons()-opcomparisons;
+
+  Cost(COST_COMPARE,comparisons);
+  if (wallclock) {
+    double t=(WallTime()-opstart)-(threaddiskwall-opdiskwallstart);
+    if (t>0) {
+      ChargeTime(t);
+    }
+  }
+  if (trace) {
+    trace->Record(TRACE_ENDOP,0,comparisons,GetCurrentTime(),GetCurrentTime());
+  }
+}
+
+double BufferCache::GetCPUTime() const
+{
+  double t;
+
+  __atomic_load(&cputime,&t,__ATOMIC_RELAXED);
+  return t;
+}
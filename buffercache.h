@@ -2,39 +2,462 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <pthread.h>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "replacement.h"
+#include "mrc.h"
+#include "victimcache.h"
+#include "trace.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-  bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-    return s1<s2;
-  }
+class BufferCache;
+
+//
+// Descriptor of a slot in the cache.  Frames live in a fixed array
+// and are linked by index into hash chains (or the free list).
+// Recency and other replacement state is kept by the
+// ReplacementPolicy, by frame index.  The data of frame f is
+// blocksize bytes at arena+f*blocksize.
+//
+struct BufferFrame {
+  SIZE_T blocknum;
+  SIZE_T hashnext;   // next frame in hash chain or free list
+  SIZE_T shard;      // shard that owns this frame
+  SIZE_T pincount;   // pinned frames are never evicted
+  double readytime;  // simulated time at which a prefetch completes
+  double flushmark;  // how much write-back work the disk must have done
+                     // for this frame's last write-back to be on disk
+  bool   dirty;
+  bool   inflight;   // a prefetch is reading into this frame
+  bool   flushing;   // a background write-back of this frame is queued
+  bool   prefetched; // prefetched and not yet used
+  bool   batched;    // read for ReadBlocks and not yet used
+  bool   readahead;  // read ahead of a sequential reader and not yet used
+  SIZE_T tag;        // tag of the last tagged access, see BufferTagStats
+  SIZE_T priority;   // retention priority, see BlockHandle::SetPriority
+  bool   inring;     // loaded by a scan and kept out of the policy
+};
+
+
+//
+// A contiguous run of blocks handed to the I/O worker, either
+// prefetched into the frames or written back from them.  A write
+// carries a copy of the data taken when it was queued, so the
+// frames can be modified again while the write is in progress.
+//
+struct IORun {
+  SIZE_T blocknum;
+  bool   write;
+  vector<SIZE_T> frames;
+  vector<BYTE_T> data;
+  double issuetime;
+};
+
+
+//
+// A reader going through consecutive blocks.  It has read seen of
+// them so far, blocks up to end have been read ahead for it, and the
+// next read ahead will be window blocks long.
+//
+struct ReadAheadStream {
+  SIZE_T next;
+  SIZE_T seen;
+  SIZE_T window;
+  SIZE_T end;
+};
+
+
+//
+// One partition of the cache.  A shard owns a contiguous range of
+// frames and has its own latch, hash table, free list, replacement
+// policy, and scan ring.  Frame numbers are global, but the policy
+// and scan ring number frames from the start of the shard.
+//
+struct BufferShard {
+  pthread_mutex_t latch;
+  SIZE_T base, numframes;
+  vector<SIZE_T> buckets;
+  SIZE_T bucketmask;
+  SIZE_T freelist;
+  ReplacementPolicy *policy;
+  FrameList scanring;
+  SIZE_T scanringsize;
+  SIZE_T numcached;
+  SIZE_T numprefetched;
+  SIZE_T numinflight;
+  SIZE_T numdirty;
+  // Number of frames at each retention priority
+  vector<SIZE_T> numretained;
+  // Finished prefetches and write-backs, protected by the cache's iolock
+  vector<SIZE_T> iocompleted;
+  vector<SIZE_T> iofailed;
+};
+
+
+//
+// Statistics for the accesses made with one tag.  Callers label
+// pinned blocks with a tag (the btree uses node type and depth), and
+// evictions and write-backs count against the tag of the block's
+// most recent access.  Tag 0 collects untagged accesses.
+//
+struct BufferTagStats {
+  SIZE_T hits;
+  SIZE_T misses;
+  SIZE_T evictions;
+  SIZE_T writebacks;
+  double time;        // simulated time spent on the accesses
+
+  BufferTagStats() : hits(0), misses(0), evictions(0), writebacks(0), time(0) {}
+};
+
+
+//
+// Tunable options for a buffer cache.  The tools accept these as
+// extra name=value arguments after their usual ones, for example
+//
+//   sim mydisk 64 policy=arc+tinylfu < specfile
+//
+struct BufferCacheConfig {
+  string policy;      // replacement policy name, see ReplacementPolicy
+  SIZE_T shards;      // number of independently latched partitions
+  bool   hugepages;   // ask for huge pages to back the frame arena
+  double dirtyhigh;   // start background write-back above this dirty fraction
+  double dirtylow;    // and stop once the dirty fraction is down to this
+  SIZE_T readahead;   // largest read ahead window in blocks, 0 for none
+  double retain;      // share of each shard kept for high priority blocks
+  SIZE_T retainlevels; // how many of the highest priorities are honoured, 0 for none
+  double mrc;         // fraction of blocks sampled for a miss ratio curve, 0 for none
+  SIZE_T victim;      // blocks' worth of memory for compressed evicted blocks, 0 for none
+  string cpu;         // how CPU work is charged: none, model, or wall
+  double hitcost;     // with cpu=model, the time charged per cache hit,
+  double comparecost; // key comparison,
+  double copycost;    // and block copied
+  SIZE_T iodepth;     // background runs the disk may carry out at once
+  string ioengine;    // and how, see DiskQueue::Create
+  string scheduler;   // the disk's scheduler for background runs (see
+                      // DiskScheduler), or empty to sweep them upward here
+  string trace;       // file to record a block trace in (see TraceWriter), or empty
+
+  BufferCacheConfig();
+  // returns ERROR_NOERROR or ERROR_GENERAL for an unknown
+  // option or bad value
+  ERROR_T Parse(const string &nameval);
+  static void PrintUsage(ostream &os);
+};
+
+
+//
+// A pinned reference to a cached block.  While the handle is pinned,
+// GetData() points directly at the cached copy and the frame will not
+// be evicted.  Call MarkDirty() after modifying the data and Unpin()
+// when done.  The destructor unpins if the handle is still pinned.
+// SetTag labels the access for the cache's per tag statistics; it
+// may be called any time before Unpin, for example once the caller
+// has looked at the data and knows what kind of block it is.
+//
+class BlockHandle {
+ private:
+  BufferCache *cache;
+  SIZE_T frame;
+  SIZE_T tag;
+  SIZE_T priority;
+  bool   hit;
+  double time;
+
+  friend class BufferCache;
+ public:
+  BlockHandle() : cache(0), frame(0), tag(0), priority(0), hit(false), time(0) {}
+  BlockHandle(const BlockHandle &rhs) { throw GenericException(); }
+  BlockHandle & operator=(const BlockHandle &rhs) { throw GenericException(); return *this; }
+  ~BlockHandle();
+
+  bool    IsPinned() const { return cache!=0; }
+  BYTE_T *GetData() const;
+  SIZE_T  GetLength() const;
+  SIZE_T  GetBlockNum() const;
+
+  ERROR_T MarkDirty();
+  ERROR_T SetTag(const SIZE_T tag);
+  // Blocks with a higher priority are kept in preference to others,
+  // see BufferCache::MAXPRIORITY.  The block keeps its priority
+  // until it is evicted or given another one.
+  ERROR_T SetPriority(const SIZE_T priority);
+  ERROR_T Unpin();
 };
 
 
 //
-// LRU block cache with single step prefetch
+// Block cache with single step prefetch
 //
 // Write Back
 // Write Allocate
+//
+// The cached data lives in one page aligned arena of cachesize
+// blocks that is allocated when the cache is created, so misses
+// don't allocate and blocks are read and written in place.
+//
+// Lookup is through a chained hash table keyed by block number.
+// Which block to evict is up to a pluggable ReplacementPolicy
+// (LRU unless configured otherwise).  The cache tells the policy
+// about every load, hit, and eviction, and asks it for a victim
+// that is not pinned when it needs a frame.
+//
+// Between BeginScan and EndScan, blocks that are loaded go into a
+// scan ring of a quarter of the cache instead of the policy, and
+// hits don't update the policy, so a walk over the whole tree
+// recycles the ring rather than evicting the working set.  Ring
+// frames are always the first to go once the scan is over, and a
+// block in the ring joins the policy if it is used outside a scan.
+//
+// The cache is safe to use from multiple threads, except for Attach,
+// Detach, and Print.  Blocks are spread over one or more shards by
+// block number, and each operation holds only the latch of the block's
+// shard, so threads working on different shards don't contend.  The
+// simulated disk is a single device, so disk requests and the
+// simulated clock are serialized by disklock, and statistics are
+// updated atomically.  With several threads the simulated time is the
+// time the disk was busy, not the sum of each thread's waiting.
+//
+// Prefetches are read by a background I/O worker thread.  The
+// simulated disk is busy until diskfreetime, so a prefetch overlaps
+// with foreground work instead of adding its time to curtime, and a
+// foreground access to a prefetched block only waits for whatever
+// part of the read has not yet finished.  Prefetches issued together
+// are sorted and contiguous blocks are read in a single request when
+// the next foreground operation arrives.  Foreground disk requests
+// wait for queued prefetches first, so the disk sees requests in the
+// order they were issued and simulated times are reproducible.
+// The runs of a batch are ordered like an elevator, sweeping upward
+// from the disk head, or from the lowest block if the head is closer
+// to that end.  ReadBlocks queues all of its misses the same way.
+//
+// The same worker cleans dirty blocks in the background.  Once more
+// than dirtyhigh of a shard is dirty, the unpinned dirty blocks
+// closest to eviction are queued for write-back until only dirtylow
+// of the shard is dirty, so that a miss usually finds a clean victim
+// instead of waiting for a write.  A block being written back stays
+// cached until the write completes.  Write-backs are handed to the
+// worker as soon as they are queued, but the simulated disk only
+// works on them while it would otherwise be idle, so they never hold
+// up a foreground request.  Evicting a block whose write-back the
+// disk hasn't got to yet waits for it, and that wait is counted as a
+// write-back stall.  This is off unless dirtyhigh is set below 1.
+//
+// Sequential reading is detected by watching misses and the first
+// use of each block read ahead.  A miss on the block after the last
+// one a stream read starts reading ahead, four blocks at first and
+// then twice as many each time up to the configured limit.  The next
+// window is queued once the reader is halfway through the previous
+// one, so reads stay ahead of the reader.  Read ahead blocks come
+// from the same quarter of each shard as prefetched ones, only
+// allocated blocks are read ahead, and a read ahead never evicts a
+// dirty block.
+//
+// Callers can give blocks a retention priority.  Each shard works
+// out the lowest priority whose blocks, together with all those of
+// higher priority, fit in its retain share, and the policy is never
+// offered those blocks as victims.  Everything else is evicted as the
+// policy sees fit.  Only the retainlevels highest priorities count,
+// and none do by default.
+//
+// With the victim option, clean blocks that are evicted go on to a
+// compressed tier in memory, see VictimCache, which is checked before
+// reading a missed block from disk.
+//
+// The simulated clock normally only counts the disk.  With cpu=model
+// it also charges a configured cost for each cache hit, block copy,
+// and (through the btree) key comparison, and with cpu=wall the real
+// time each operation takes apart from waiting for the disk.
+//
+// With the mrc option, every access is also fed to a sampled reuse
+// distance histogram, see MissRatioCurve, to estimate how other cache
+// sizes would have done on the same run.
+//
+// Write-back is done in block order and neighbouring dirty blocks
+// are written in one request, which the disk serves much faster than
+// scattered writes.  This applies to the background write-backs, to
+// Detach, and to a miss that has to evict a dirty block.
+//
 class BufferCache {
  private:
+  static const SIZE_T NOFRAME = 0xffffffff;
+  // sequential readers followed at once
+  static const SIZE_T NUMSTREAMS = 4;
+  // and how many blocks in a row start a read ahead
+  static const SIZE_T RASTART = 3;
+
+  friend class BlockHandle;
+
   DiskSystem *disk;
   SIZE_T cachesize;
-  map<SIZE_T, Block, cache_compare_lessthan> blockmap;
+  SIZE_T blocksize;
+  BYTE_T *arena;
+  size_t arenasize;
+  vector<BufferFrame> frames;
+  vector<BufferShard> shards;
+  BufferCacheConfig config;
+  // The disk's queue and scheduler before the cache set its own,
+  // put back by the destructor
+  SIZE_T olddepth;
+  string oldengine;
+  string oldscheduler;
+  SIZE_T scandepth;
+  // Simulated clock, written with disklock held
   double curtime;
+  double diskfreetime;
+  // Statistics, updated atomically
   SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+  SIZE_T prefetches, prefetchhits, prefetchwasted;
+  SIZE_T flushes, writebackstalls;
+  // Simulated time misses spent writing back dirty victims or
+  // waiting for their write-backs, written with disklock held
+  double writebackstalltime;
+  // Simulated time the write-backs handed to the disk take in all,
+  // and how much of it the disk has spent on them, written with
+  // disklock held
+  double flushqueued;
+  double flushdone;
+  vector<BufferTagStats> tagstats;
+  vector<string> tagnames;
+  SIZE_T readaheads, readaheadhits, readaheadwasted;
+  // Sequential stream detection, protected by ralock
+  pthread_mutex_t ralock;
+  vector<ReadAheadStream> rastreams;
+  SIZE_T ranext;
+  // Sampled reuse distances of the accesses, 0 unless configured
+  MissRatioCurve *misscurve;
+  // Misses that read the block, and the simulated time they took
+  SIZE_T readmisses;
+  double readmisstime;
+  // Compressed second tier, 0 unless configured
+  VictimCache *victims;
+  // Time the disk took over the foreground reads, written
+  // with disklock held
+  double readreqtime;
+  // CPU cost model: the time per event with cpu=model, and whether
+  // to charge the real time of operations instead with cpu=wall
+  vector<double> costs;
+  bool   wallclock;
+  // Simulated time charged for CPU work, written with disklock held
+  double cputime;
+  // Records the calls made on the cache and the requests the disk
+  // serves, 0 unless configured
+  TraceWriter *trace;
+
+  // Background I/O worker state, protected by iolock
+  pthread_t       ioworker;
+  bool            ioworkerrunning;
+  bool            ioshutdown;
+  pthread_mutex_t iolock;
+  pthread_cond_t  iowork;
+  pthread_cond_t  iodone;
+  // Serializes the disk, the simulated clock, and the
+  // allocation bitmap updates
+  pthread_mutex_t disklock;
+  deque<IORun> ioqueue;
+  // Prefetches and ReadBlocks misses not yet handed to the
+  // worker, as (block, frame)
+  vector<pair<SIZE_T, SIZE_T> > pendingreads;
+  // Write-backs not yet handed to the worker
+  vector<IORun> pendingflush;
+
+  // These all require the shard's latch to be held
+  SIZE_T FindFrame(const BufferShard &shard, const SIZE_T blocknum) const;
+  void   HashInsert(BufferShard &shard, const SIZE_T frame);
+  void   HashRemove(BufferShard &shard, const SIZE_T frame);
+  // Frames currently holding blocks, in no particular order
+  void   GetCachedFrames(const BufferShard &shard, vector<SIZE_T> &cached) const;
+  BufferShard & ShardOf(const SIZE_T blocknum);
+  BYTE_T *FrameData(const SIZE_T frame) const { return arena+(size_t)frame*blocksize; }
+  bool   AllocateArena(const SIZE_T numframes);
+  void   FreeArena();
+  bool   InScan() const;
+  void   SetDirty(BufferShard &shard, const SIZE_T frame, const bool dirty);
+  void   CountAccess(const SIZE_T tag, const bool hit, const double time);
+  void   CountWriteback(const SIZE_T frame);
+  void   ResetFrames();
+  // Advances the simulated clock to at least t
+  void   WaitUntil(const double t);
+  // Lets the disk spend the time it is idle before t on write-backs.
+  // Requires disklock to be held.
+  void   IdleFlush(const double t);
+  // Advances the simulated clock until the frame's last write-back
+  // is on disk, counting the wait as a write-back stall
+  void   WaitForFlush(const SIZE_T frame);
+
+  static void *IOWorkerMain(void *cache);
+  void   IOWorker();
+  bool   StartIOWorker();
+  void   StopIOWorker();
+  // Require iolock to be held
+  void   SubmitIO();
+  void   ElevatorOrder(const SIZE_T firstrun, SIZE_T &head);
+  void   WaitForIO(BufferShard &shard);
+  void   ReapIO(BufferShard &shard);
  protected:
-  ERROR_T CheckDeleteOldest();
+  // Adds t to the simulated clock as CPU time
+  void    ChargeTime(const double t);
+  // Foreground disk access, charged against the simulated clock
+  ERROR_T DiskRead(BufferShard &shard, const SIZE_T blocknum, BYTE_T *data);
+  ERROR_T DiskWrite(BufferShard &shard, const SIZE_T blocknum, const SIZE_T numblocks, const BYTE_T *data);
+  // Writes the frames, which hold consecutive blocks, in one
+  // request and marks them clean
+  ERROR_T WriteRun(BufferShard &shard, const vector<SIZE_T> &run);
+  // The dirty victim f together with the unpinned dirty blocks
+  // cached next to it, in block order
+  void    ClusterDirty(BufferShard &shard, const SIZE_T frame, vector<SIZE_T> &run);
+  // The policy's choice of unpinned frame to replace in order
+  // to load blocknum, or NOFRAME.  With peek, the policy's state is
+  // left alone, for callers that only want to look at the frame
+  // before deciding whether to load anything.
+  SIZE_T  FindVictim(BufferShard &shard, const SIZE_T blocknum, const bool peek=false);
+  // Lowest priority whose frames are currently kept from eviction
+  SIZE_T  RetainedPriority(const BufferShard &shard) const;
+  void    SetPriority(BufferShard &shard, const SIZE_T frame, const SIZE_T priority);
+  // Finds the frame holding blocknum, loading it on a miss
+  // (reading it from disk only if fetch is true) and tells
+  // the policy about the access
+  // ahead is set if the access should be considered for read ahead
+  ERROR_T LookupFrame(BufferShard &shard, const SIZE_T blocknum, const bool fetch, SIZE_T &frame, bool &hit, bool &ahead);
+  ERROR_T CheckDeleteOldest(BufferShard &shard, const SIZE_T blocknum);
+  // Queues background write-backs if the shard is over
+  // its dirty high watermark, leaving alone the frame
+  // that was just written
+  void    CheckFlush(BufferShard &shard, const SIZE_T written);
+  // Returns a frame that is unlinked from everything,
+  // evicting the policy's victim if needed
+  ERROR_T GetFreeFrame(BufferShard &shard, const SIZE_T blocknum, SIZE_T &frame);
+  // Claims a frame for blocknum and queues a background read into it
+  ERROR_T QueueRead(BufferShard &shard, const SIZE_T blocknum, SIZE_T &frame);
+  // Whether a speculative read of blocknum would fit: there is
+  // room for one more unused speculative block, and it would not
+  // have to evict a dirty one
+  bool    CanReadEarly(BufferShard &shard, const SIZE_T blocknum);
+  // Called after a miss on blocknum or the first use of a block
+  // read ahead, without holding any latch
+  void    ReadAhead(const SIZE_T blocknum);
+  // Hands a newly loaded frame to the policy or the scan ring
+  void    AdmitFrame(BufferShard &shard, const SIZE_T frame);
+  void    TouchFrame(BufferShard &shard, const SIZE_T frame);
+  // Unhashes the frame and returns it to the free list
+  void    EvictFrame(BufferShard &shard, const SIZE_T frame);
+  void    ReleaseFrame(BufferShard &shard, const SIZE_T frame);
  public:
   // Cache size is in number of blocks
+  // Throws GenericException if the configuration names
+  // an unknown replacement policy, the arena can't be allocated,
+  // or the trace file can't be created
   BufferCache(DiskSystem *disk,
-	      const SIZE_T cachesize);
+	      const SIZE_T cachesize,
+	      const BufferCacheConfig &config=BufferCacheConfig());
   BufferCache() { throw 0; }
   BufferCache(const BufferCache &rhs) { throw 0; } 
   BufferCache & operator=(const BufferCache &rhs) { throw 0; return *this; } 
@@ -53,6 +476,8 @@ class BufferCache {
   SIZE_T GetNumBlocks() const;
   // Current time in the simulation (starts at zero)
   double GetCurrentTime() const;
+  // Number of shards the cache is split into
+  SIZE_T GetNumShards() const { return shards.size(); }
 
   // outblocknum is the number of the block that we just allocated
   // if the error return is nonzero
@@ -65,32 +490,127 @@ class BufferCache {
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK or other nonzero error codes
   ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock);
+
+  // Reads several blocks into outblocks, in the same order.  All the
+  // misses are read together, with neighbouring blocks merged into
+  // one disk request and the requests in elevator order, so this is
+  // cheaper than reading the blocks one at a time.
+  // returns one of ERROR_NOERROR  (zero)
+  // ERROR_NOSUCHBLOCK or other nonzero error codes
+  ERROR_T ReadBlocks(const vector<SIZE_T> &blocknums, vector<Block> &outblocks);
   
   // returns one of ERROR_NOERROR  (zero)
   // ERROR_NOSUCHBLOCK
   // ERROR_WRONGSIZEBLOCK or other nonzero error codes
   ERROR_T WriteBlock(const SIZE_T inblocknum, const Block &inblock);
+
+  // Pin a block in the cache without copying it out.  If overwrite
+  // is true, the caller will replace the entire contents, so a miss
+  // does not read the block from disk and the block is marked dirty.
+  // returns one of ERROR_NOERROR  (zero)
+  // ERROR_NOSPACE if every frame is pinned
+  // ERROR_ALREADY if the handle is already pinned
+  // or other nonzero error codes
+  // All handles must be unpinned before Detach
+  ERROR_T PinBlock(const SIZE_T blocknum, BlockHandle &handle, const bool overwrite=false);
+  ERROR_T MarkDirty(BlockHandle &handle);
+  ERROR_T UnpinBlock(BlockHandle &handle);
+
+  // Tags are numbered from 0 (untagged) to MAXTAGS-1, larger
+  // tags are counted as MAXTAGS-1
+  static const SIZE_T MAXTAGS = 64;
+  void   SetTagName(const SIZE_T tag, const string &name);
+  string GetTagName(const SIZE_T tag) const;
+  BufferTagStats GetTagStats(const SIZE_T tag) const;
+  // One line per tag that has been used, or a JSON array
+  // of objects if json is true
+  ostream & PrintTagStats(ostream &os, const bool json=false) const;
+
+  // The estimated miss ratio for other cache sizes, if the mrc
+  // option is on, or 0
+  const MissRatioCurve *GetMissRatioCurve() const { return misscurve; }
+  // Estimated misses that read the block, and simulated time, at
+  // cache sizes from 1 up to the number of blocks used, doubling
+  // each time, and at this cache's size.  Times assume each miss
+  // costs what such misses cost in this run on average, and that
+  // everything else takes as long as it did.
+  ostream & PrintMissRatioCurve(ostream &os) const;
+
+  // CPU work the cost model charges for
+  enum CostEvent { COST_HIT, COST_COMPARE, COST_COPY, NUMCOSTEVENTS };
+  // With cpu=model, advances the simulated clock by the configured
+  // cost of count events, otherwise does nothing
+  void   Charge(const CostEvent event, const SIZE_T count=1);
+  // Called around each operation by drivers like sim.  With
+  // cpu=model, the key comparisons the calling thread made in between
+  // are charged at the end, and with cpu=wall, the real time in
+  // between less the time the thread spent waiting for the disk.
+  void   BeginOperation();
+  void   EndOperation();
+  // Simulated time charged for CPU work so far
+  double GetCPUTime() const;
+
+  // The compressed tier, if the victim option is on, or 0
+  const VictimCache *GetVictimCache() const { return victims; }
+  // Simulated disk time its hits saved, taking each to cost what
+  // the reads that did go to disk took on average
+  double GetVictimSavedTime() const;
+
+  // Retention priorities run from 0 (none, the default) to
+  // MAXPRIORITY.  Blocks with a priority are not evicted as long as
+  // they fit in the retain share of their shard; when they don't,
+  // the highest priorities are the ones kept.
+  static const SIZE_T MAXPRIORITY = 7;
   
   // Request that a block be read into the cache
   // This returns immediately.
   // ERROR_NOFETCH means that there is no room currently
   // to prefetch the block and it was not prefetched.
+  // At most a quarter of the cache holds prefetched blocks
+  // that have not been used yet, and a prefetch never
+  // evicts a dirty block.
   ERROR_T PrefetchBlock (const SIZE_T blocknum);
   
+  // Bracket a traversal that touches most blocks once
+  // (a full Display or SanityCheck, for example) so that it
+  // doesn't flush the working set.  Scans may nest.
+  void BeginScan();
+  void EndScan();
+
   // Request that a block be flushed to disk
   // Note that this blocks until the block is finished.
+  // A pinned block is written back but stays in the cache.
   ERROR_T FlushBlock(const SIZE_T blocknum);
   
  
-  SIZE_T GetNumAllocs() const { return allocs; }
-  SIZE_T GetNumDeallocs() const { return deallocs; }
-  SIZE_T GetNumReads() const { return reads;}
-  SIZE_T GetNumWrites() const { return writes;}
-  SIZE_T GetNumDiskReads() const { return diskreads;}
-  SIZE_T GetNumDiskWrites() const { return diskwrites;}
+  SIZE_T GetNumAllocs() const { return __atomic_load_n(&allocs,__ATOMIC_RELAXED); }
+  SIZE_T GetNumDeallocs() const { return __atomic_load_n(&deallocs,__ATOMIC_RELAXED); }
+  SIZE_T GetNumReads() const { return __atomic_load_n(&reads,__ATOMIC_RELAXED); }
+  SIZE_T GetNumWrites() const { return __atomic_load_n(&writes,__ATOMIC_RELAXED); }
+  SIZE_T GetNumDiskReads() const { return __atomic_load_n(&diskreads,__ATOMIC_RELAXED); }
+  SIZE_T GetNumDiskWrites() const { return __atomic_load_n(&diskwrites,__ATOMIC_RELAXED); }
+  SIZE_T GetNumPrefetches() const { return __atomic_load_n(&prefetches,__ATOMIC_RELAXED); }
+  SIZE_T GetNumPrefetchHits() const { return __atomic_load_n(&prefetchhits,__ATOMIC_RELAXED); }
+  SIZE_T GetNumPrefetchWasted() const { return __atomic_load_n(&prefetchwasted,__ATOMIC_RELAXED); }
+  // Blocks written back by the background flusher
+  SIZE_T GetNumFlushes() const { return __atomic_load_n(&flushes,__ATOMIC_RELAXED); }
+  // Misses that had to write back a dirty victim first,
+  // and the simulated time they spent doing it
+  SIZE_T GetNumWritebackStalls() const { return __atomic_load_n(&writebackstalls,__ATOMIC_RELAXED); }
+  double GetWritebackStallTime() const;
+  // Blocks read ahead, and how many of them were used or
+  // evicted without being used
+  SIZE_T GetNumReadAheads() const { return __atomic_load_n(&readaheads,__ATOMIC_RELAXED); }
+  SIZE_T GetNumReadAheadHits() const { return __atomic_load_n(&readaheadhits,__ATOMIC_RELAXED); }
+  SIZE_T GetNumReadAheadWasted() const { return __atomic_load_n(&readaheadwasted,__ATOMIC_RELAXED); }
+  string GetPolicyName() const { return shards[0].policy->GetName(); }
 
   ostream & Print(ostream &os) const;
-  
+
+ private:
+  // Charge, without recording it in the trace, for the cache's own
+  // charges, which a replay makes again by itself
+  void   Cost(const CostEvent event, const SIZE_T count=1);
 };
 
 
@@ -0,0 +1,165 @@
+#include <string.h>
+
+#include "compress.h"
+
+static const SIZE_T MINMATCH=4;
+static const SIZE_T MAXOFFSET=65535;
+static const SIZE_T HASHBITS=12;
+static const SIZE_T NOPOS=0xffffffff;
+
+
+static inline SIZE_T Read32(const BYTE_T *p)
+{
+  SIZE_T v;
+
+  memcpy(&v,p,sizeof(v));
+  return v;
+}
+
+static inline SIZE_T Hash(const SIZE_T seq)
+{
+  return (SIZE_T)(seq*2654435761U)>>(32-HASHBITS);
+}
+
+// Writes the part of a length that doesn't fit in its nibble
+static bool PutLength(BYTE_T *out, SIZE_T &op, const SIZE_T max, SIZE_T len)
+{
+  if (len<15) {
+    return true;
+  }
+  for (len-=15;;len-=255) {
+    if (op>=max) {
+      return false;
+    }
+    if (len<255) {
+      out[op++]=(BYTE_T)len;
+      return true;
+    }
+    out[op++]=255;
+  }
+}
+
+static bool GetLength(const BYTE_T *in, SIZE_T &ip, const SIZE_T len, SIZE_T &n)
+{
+  BYTE_T b;
+
+  if (n<15) {
+    return true;
+  }
+  do {
+    if (ip>=len) {
+      return false;
+    }
+    b=in[ip++];
+    n+=b;
+  } while (b==255);
+  return true;
+}
+
+// A sequence with matchlen 0 is the final literals only one
+static bool PutSequence(BYTE_T *out, SIZE_T &op, const SIZE_T max,
+			const BYTE_T *lit, const SIZE_T litlen,
+			const SIZE_T offset, const SIZE_T matchlen)
+{
+  SIZE_T m = matchlen>0 ? matchlen-MINMATCH : 0;
+
+  if (op>=max) {
+    return false;
+  }
+  out[op++]=(BYTE_T)(((litlen<15 ? litlen : 15)<<4) | (m<15 ? m : 15));
+  if (!PutLength(out,op,max,litlen) || op+litlen>max) {
+    return false;
+  }
+  memcpy(out+op,lit,litlen);
+  op+=litlen;
+  if (matchlen==0) {
+    return true;
+  }
+  if (op+2>max) {
+    return false;
+  }
+  out[op++]=(BYTE_T)(offset&0xff);
+  out[op++]=(BYTE_T)(offset>>8);
+  return PutLength(out,op,max,m);
+}
+
+
+SIZE_T LZCompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T max)
+{
+  SIZE_T table[1<<HASHBITS];
+  SIZE_T ip=0, anchor=0, op=0;
+
+  for (SIZE_T i=0;i<(1<<HASHBITS);i++) {
+    table[i]=NOPOS;
+  }
+
+  while (ip+MINMATCH<=len) {
+    SIZE_T seq=Read32(in+ip);
+    SIZE_T h=Hash(seq);
+    SIZE_T cand=table[h];
+
+    table[h]=ip;
+    if (cand==NOPOS || ip-cand>MAXOFFSET || Read32(in+cand)!=seq) {
+      ip++;
+      continue;
+    }
+
+    SIZE_T matchlen=MINMATCH;
+
+    while (ip+matchlen<len && in[cand+matchlen]==in[ip+matchlen]) {
+      matchlen++;
+    }
+    if (!PutSequence(out,op,max,in+anchor,ip-anchor,ip-cand,matchlen)) {
+      return 0;
+    }
+    ip+=matchlen;
+    anchor=ip;
+  }
+
+  if (!PutSequence(out,op,max,in+anchor,len-anchor,0,0)) {
+    return 0;
+  }
+  return op;
+}
+
+
+bool LZDecompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outlen)
+{
+  SIZE_T ip=0, op=0;
+
+  while (ip<len) {
+    BYTE_T token=in[ip++];
+    SIZE_T litlen=token>>4;
+
+    if (!GetLength(in,ip,len,litlen) || ip+litlen>len || op+litlen>outlen) {
+      return false;
+    }
+    memcpy(out+op,in+ip,litlen);
+    ip+=litlen;
+    op+=litlen;
+
+    if (ip==len) {
+      break;
+    }
+    if (ip+2>len) {
+      return false;
+    }
+
+    SIZE_T offset=in[ip] | (in[ip+1]<<8);
+    SIZE_T matchlen=token&15;
+
+    ip+=2;
+    if (!GetLength(in,ip,len,matchlen)) {
+      return false;
+    }
+    matchlen+=MINMATCH;
+    if (offset==0 || offset>op || op+matchlen>outlen) {
+      return false;
+    }
+    // the match may overlap what it produces, so byte by byte
+    for (SIZE_T i=0;i<matchlen;i++,op++) {
+      out[op]=out[op-offset];
+    }
+  }
+  return op==outlen;
+}
@@ -0,0 +1,23 @@
+#ifndef _compress
+#define _compress
+
+#include "global.h"
+
+//
+// A small LZ77 compressor in the style of LZ4, fast enough to run on
+// every eviction.  The output is a series of sequences, each a token
+// byte (literal count in the high nibble, match length less 4 in the
+// low one, 15 meaning more length bytes follow), the literals, and a
+// two byte little endian offset back to the match.  The last
+// sequence has literals only.
+//
+
+// Compresses len bytes of in into out, which has room for max bytes.
+// returns the compressed length, or 0 if it doesn't fit
+SIZE_T LZCompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T max);
+
+// Decompresses len bytes of in into out, which must come to exactly
+// outlen bytes.  returns false if the input is not valid
+bool   LZDecompress(const BYTE_T *in, const SIZE_T len, BYTE_T *out, const SIZE_T outlen);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 
 #include "disksystem.h"
+#include "arraydisk.h"
 
 
 void usage() 
@@ -20,6 +21,18 @@ int main(int argc, char *argv[])
   remove((string(argv[1])+".data").c_str());
   remove((string(argv[1])+".bitmap").c_str());
   remove((string(argv[1])+".config").c_str());
+  remove((string(argv[1])+".ftl").c_str());
+
+  // and the members, if it is an array
+  for (SIZE_T i=0;;i++) { 
+    string member=ArrayDiskSystem::MemberName(argv[1],i);
+    if (remove((member+".config").c_str())) { 
+      break;
+    }
+    remove((member+".data").c_str());
+    remove((member+".bitmap").c_str());
+    remove((member+".ftl").c_str());
+  }
 
   cerr << "Done.\n";
 
@@ -0,0 +1,373 @@
+// off_t is 64 bits even where long is not
+#define _FILE_OFFSET_BITS 64
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "diskqueue.h"
+
+// Enough threads to keep a fast device busy without swamping the host
+static const SIZE_T MAXTHREADS=64;
+
+
+bool DiskQueue::IsValidEngine(const string &engine)
+{
+  return engine=="auto" || engine=="uring" || engine=="threads";
+}
+
+DiskQueue *DiskQueue::Create(const string &engine, const int fd, const SIZE_T depth)
+{
+  if (!IsValidEngine(engine) || depth<1) {
+    return 0;
+  }
+  if (engine!="threads") {
+    URingQueue *q=new URingQueue(fd,depth);
+    if (q->IsOpen()) {
+      return q;
+    }
+    delete q;
+    // kernels can be too old, or sandboxes forbid io_uring
+    if (engine=="uring") {
+      return 0;
+    }
+  }
+  try {
+    return new ThreadPoolQueue(fd,depth<MAXTHREADS ? depth : MAXTHREADS);
+  } catch (GenericException &) {
+    // not even one worker thread could be started
+    return 0;
+  }
+}
+
+
+#ifdef __NR_io_uring_setup
+
+static int io_uring_setup(const unsigned entries, struct io_uring_params *p)
+{
+  return syscall(__NR_io_uring_setup,entries,p);
+}
+
+static int io_uring_enter(const int fd, const unsigned submit, const unsigned min, const unsigned flags)
+{
+  return syscall(__NR_io_uring_enter,fd,submit,min,flags,0,0);
+}
+
+URingQueue::URingQueue(const int fd, const SIZE_T depth) :
+  DiskQueue(fd,depth), ringfd(-1), sqring(MAP_FAILED), cqring(MAP_FAILED),
+  sqringsize(0), cqringsize(0), sqes(MAP_FAILED), sqessize(0), unsubmitted(0),
+  inkernel(0), broken(false)
+{
+  struct io_uring_params p;
+
+  memset(&p,0,sizeof(p));
+  if ((ringfd=io_uring_setup(depth,&p))<0) {
+    ringfd=-1;
+    return;
+  }
+
+  sqringsize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+  cqringsize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cqringsize>sqringsize) {
+      sqringsize=cqringsize;
+    }
+    cqringsize=sqringsize;
+  }
+  sqring=mmap(0,sqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQ_RING);
+  if (sqring==MAP_FAILED) {
+    close(ringfd);
+    ringfd=-1;
+    return;
+  }
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    cqring=sqring;
+  } else {
+    cqring=mmap(0,cqringsize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_CQ_RING);
+  }
+  sqessize=p.sq_entries*sizeof(struct io_uring_sqe);
+  if (cqring!=MAP_FAILED) {
+    sqes=mmap(0,sqessize,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,ringfd,IORING_OFF_SQES);
+  }
+  if (cqring==MAP_FAILED || sqes==MAP_FAILED) {
+    // the destructor unmaps whatever we did get
+    close(ringfd);
+    ringfd=-1;
+    return;
+  }
+
+  BYTE_T *sq=(BYTE_T *)sqring;
+  BYTE_T *cq=(BYTE_T *)cqring;
+
+  sqhead=(unsigned *)(sq+p.sq_off.head);
+  sqtail=(unsigned *)(sq+p.sq_off.tail);
+  sqmask=(unsigned *)(sq+p.sq_off.ring_mask);
+  sqarray=(unsigned *)(sq+p.sq_off.array);
+  cqhead=(unsigned *)(cq+p.cq_off.head);
+  cqtail=(unsigned *)(cq+p.cq_off.tail);
+  cqmask=(unsigned *)(cq+p.cq_off.ring_mask);
+  cqes=cq+p.cq_off.cqes;
+
+  // Some sandboxes let the ring be set up but not used, so make sure
+  // a no-op goes through
+  struct io_uring_sqe *sqe=(struct io_uring_sqe *)sqes;
+  unsigned tail=*sqtail;
+
+  memset(sqe,0,sizeof(*sqe));
+  sqe->opcode=IORING_OP_NOP;
+  sqarray[tail & *sqmask]=0;
+  __atomic_store_n(sqtail,tail+1,__ATOMIC_RELEASE);
+  if (io_uring_enter(ringfd,1,1,IORING_ENTER_GETEVENTS)!=1 ||
+      __atomic_load_n(cqtail,__ATOMIC_ACQUIRE)==*cqhead) {
+    close(ringfd);
+    ringfd=-1;
+    return;
+  }
+  __atomic_store_n(cqhead,*cqhead+1,__ATOMIC_RELEASE);
+}
+
+URingQueue::~URingQueue()
+{
+  if (sqes!=MAP_FAILED) {
+    munmap(sqes,sqessize);
+  }
+  if (cqring!=MAP_FAILED && cqring!=sqring) {
+    munmap(cqring,cqringsize);
+  }
+  if (sqring!=MAP_FAILED) {
+    munmap(sqring,sqringsize);
+  }
+  if (ringfd>=0) {
+    close(ringfd);
+  }
+}
+
+void URingQueue::Start(const vector<DiskRequest *> &reqs)
+{
+  if (broken) {
+    for (vector<DiskRequest *>::const_iterator i=reqs.begin(); i!=reqs.end(); ++i) {
+      (*i)->result=0;
+    }
+    abandoned.insert(abandoned.end(),reqs.begin(),reqs.end());
+    return;
+  }
+
+  // Only we move the tail, and the depth keeps us clear of the head
+  unsigned tail=*sqtail;
+
+  for (vector<DiskRequest *>::const_iterator i=reqs.begin(); i!=reqs.end(); ++i, ++tail) {
+    unsigned idx=tail & *sqmask;
+    struct io_uring_sqe *sqe=((struct io_uring_sqe *)sqes)+idx;
+
+    memset(sqe,0,sizeof(*sqe));
+    sqe->opcode=(*i)->write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd=fd;
+    sqe->off=(*i)->offset;
+    sqe->addr=(unsigned long)(*i)->data;
+    sqe->len=(*i)->length;
+    sqe->user_data=(unsigned long)(*i);
+    sqarray[idx]=idx;
+  }
+  __atomic_store_n(sqtail,tail,__ATOMIC_RELEASE);
+  unsubmitted+=reqs.size();
+
+  int err=Enter(0);
+  if (err<0) {
+    Abandon(err);
+  }
+}
+
+int URingQueue::Enter(const SIZE_T min)
+{
+  for (;;) {
+    int n=io_uring_enter(ringfd,unsubmitted,min,min>0 ? IORING_ENTER_GETEVENTS : 0);
+    if (n>=0) {
+      unsubmitted-=n;
+      inkernel+=n;
+      return 0;
+    }
+    if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY) {
+      return -errno;
+    }
+  }
+}
+
+void URingQueue::Abandon(const int err)
+{
+  // Without SQPOLL the kernel only looks at the submission ring
+  // inside io_uring_enter, so the unsubmitted entries are ours again
+  unsigned tail=*sqtail-unsubmitted;
+
+  for (unsigned t=tail;t!=*sqtail;t++) {
+    struct io_uring_sqe *sqe=((struct io_uring_sqe *)sqes)+(t & *sqmask);
+    DiskRequest *req=(DiskRequest *)(unsigned long)sqe->user_data;
+
+    req->result=err;
+    abandoned.push_back(req);
+  }
+  __atomic_store_n(sqtail,tail,__ATOMIC_RELEASE);
+  unsubmitted=0;
+  broken=true;
+}
+
+void URingQueue::Wait(vector<DiskRequest *> &done, const SIZE_T min)
+{
+  SIZE_T found=0;
+
+  for (;;) {
+    found+=abandoned.size();
+    done.insert(done.end(),abandoned.begin(),abandoned.end());
+    abandoned.clear();
+
+    unsigned head=*cqhead;
+    unsigned tail=__atomic_load_n(cqtail,__ATOMIC_ACQUIRE);
+
+    for (;head!=tail;head++, found++) {
+      struct io_uring_cqe *cqe=((struct io_uring_cqe *)cqes)+(head & *cqmask);
+      DiskRequest *req=(DiskRequest *)(unsigned long)cqe->user_data;
+
+      req->result=cqe->res;
+      done.push_back(req);
+      inkernel--;
+    }
+    __atomic_store_n(cqhead,head,__ATOMIC_RELEASE);
+    if (found>=min || (broken && inkernel==0)) {
+      return;
+    }
+    if (broken) {
+      // what the kernel took still completes, we just can't wait
+      // for it in io_uring_enter
+      usleep(100);
+      continue;
+    }
+
+    int err=Enter(min-found);
+    if (err<0) {
+      Abandon(err);
+    }
+  }
+}
+
+#else
+
+// Without the system calls the ring never opens, and auto falls back
+// to threads
+URingQueue::URingQueue(const int fd, const SIZE_T depth) :
+  DiskQueue(fd,depth), ringfd(-1)
+{}
+
+URingQueue::~URingQueue()
+{}
+
+void URingQueue::Start(const vector<DiskRequest *> &reqs)
+{}
+
+int URingQueue::Enter(const SIZE_T min)
+{
+  return 0;
+}
+
+void URingQueue::Abandon(const int err)
+{}
+
+void URingQueue::Wait(vector<DiskRequest *> &done, const SIZE_T min)
+{}
+
+#endif
+
+
+ThreadPoolQueue::ThreadPoolQueue(const int fd, const SIZE_T depth) :
+  DiskQueue(fd,depth), shutdown(false)
+{
+  pthread_mutex_init(&lock,0);
+  pthread_cond_init(&work,0);
+  pthread_cond_init(&finished,0);
+
+  for (SIZE_T i=0;i<depth;i++) {
+    pthread_t t;
+    if (pthread_create(&t,0,WorkerMain,this)) {
+      break;
+    }
+    threads.push_back(t);
+  }
+  if (threads.empty()) {
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&work);
+    pthread_mutex_destroy(&lock);
+    throw GenericException();
+  }
+}
+
+ThreadPoolQueue::~ThreadPoolQueue()
+{
+  pthread_mutex_lock(&lock);
+  shutdown=true;
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+
+  for (SIZE_T i=0;i<threads.size();i++) {
+    pthread_join(threads[i],0);
+  }
+
+  pthread_cond_destroy(&finished);
+  pthread_cond_destroy(&work);
+  pthread_mutex_destroy(&lock);
+}
+
+void *ThreadPoolQueue::WorkerMain(void *queue)
+{
+  ((ThreadPoolQueue *)queue)->Worker();
+  return 0;
+}
+
+void ThreadPoolQueue::Worker()
+{
+  pthread_mutex_lock(&lock);
+  while (!shutdown) {
+    if (pending.empty()) {
+      pthread_cond_wait(&work,&lock);
+      continue;
+    }
+    DiskRequest *req=pending.front();
+    pending.pop_front();
+    pthread_mutex_unlock(&lock);
+
+    ssize_t n;
+
+    do {
+      if (req->write) {
+	n=pwrite(fd,req->data,req->length,req->offset);
+      } else {
+	n=pread(fd,req->data,req->length,req->offset);
+      }
+    } while (n<0 && errno==EINTR);
+    req->result = n<0 ? -errno : n;
+
+    pthread_mutex_lock(&lock);
+    completed.push_back(req);
+    pthread_cond_signal(&finished);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void ThreadPoolQueue::Start(const vector<DiskRequest *> &reqs)
+{
+  pthread_mutex_lock(&lock);
+  pending.insert(pending.end(),reqs.begin(),reqs.end());
+  pthread_cond_broadcast(&work);
+  pthread_mutex_unlock(&lock);
+}
+
+void ThreadPoolQueue::Wait(vector<DiskRequest *> &done, const SIZE_T min)
+{
+  pthread_mutex_lock(&lock);
+  while (completed.size()<min) {
+    pthread_cond_wait(&finished,&lock);
+  }
+  done.insert(done.end(),completed.begin(),completed.end());
+  completed.clear();
+  pthread_mutex_unlock(&lock);
+}
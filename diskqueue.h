@@ -0,0 +1,139 @@
+#ifndef _diskqueue
+#define _diskqueue
+
+#include <string>
+#include <vector>
+#include <deque>
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// A request handed to DiskSystem::Submit.  The caller fills in the
+// first four fields and keeps the request and its data alive until
+// DiskSystem::Complete has given it back.
+//
+struct DiskRequest {
+  bool    write;
+  SIZE_T  blocknum;
+  SIZE_T  numblocks;
+  BYTE_T *data;
+  // Set by Submit: the simulated time the request takes, and its
+  // place among the requests of that Submit in the order the
+  // simulated disk serves them
+  double  reqtime;
+  SIZE_T  order;
+  // Set by Complete
+  ERROR_T rc;
+  // Left alone, for the caller's use
+  void   *context;
+
+  // Used by DiskSystem and the queue: the byte offset in the data
+  // file, and how many bytes the queue transferred (or minus errno)
+  long long offset;
+  size_t  length;
+  ssize_t result;
+  // Used by the disk's scheduler: when the request arrived, by the
+  // disk's own clock
+  double  arrival;
+
+  DiskRequest() : write(false), blocknum(0), numblocks(0), data(0), reqtime(0), order(0),
+		  rc(ERROR_NOERROR), context(0), offset(0), length(0), result(0), arrival(0) {}
+};
+
+
+//
+// Carries out up to a fixed number of reads and writes of a file at
+// once for DiskSystem.  Each request is started with a single pread
+// or pwrite (or its io_uring equivalent) and DiskSystem finishes any
+// that come back short.  A queue is used by one thread at a time.
+//
+class DiskQueue {
+ protected:
+  int    fd;
+  SIZE_T depth;
+ public:
+  DiskQueue(const int fd, const SIZE_T depth) : fd(fd), depth(depth) {}
+  virtual ~DiskQueue() {}
+
+  // Starts the requests; there must be room for them under the depth
+  virtual void   Start(const vector<DiskRequest *> &reqs) = 0;
+  // Waits for at least min requests to finish, and adds the finished
+  // ones to done
+  virtual void   Wait(vector<DiskRequest *> &done, const SIZE_T min) = 0;
+  virtual string GetName() const = 0;
+  SIZE_T GetDepth() const { return depth; }
+
+  // engine is uring, threads, or auto for io_uring where the kernel
+  // allows it and threads otherwise.  returns 0 if it can't be made
+  static DiskQueue *Create(const string &engine, const int fd, const SIZE_T depth);
+  static bool IsValidEngine(const string &engine);
+};
+
+
+// io_uring, set up with raw system calls
+class URingQueue : public DiskQueue {
+ private:
+  int     ringfd;
+  void   *sqring, *cqring;
+  size_t  sqringsize, cqringsize;
+  void   *sqes;
+  size_t  sqessize;
+  unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+  unsigned *cqhead, *cqtail, *cqmask;
+  void   *cqes;
+  // Queued in the submission ring but not yet passed to the kernel,
+  // and passed to it but not yet completed
+  SIZE_T  unsubmitted;
+  SIZE_T  inkernel;
+  // Set once io_uring_enter fails in a way retrying won't fix, after
+  // which requests are handed back undone for DiskSystem to carry out
+  bool    broken;
+  vector<DiskRequest *> abandoned;
+
+  // returns 0 or minus errno
+  int    Enter(const SIZE_T min);
+  // Takes back what the kernel hasn't been given, and gives up on
+  // the ring
+  void   Abandon(const int err);
+ public:
+  URingQueue(const int fd, const SIZE_T depth);
+  ~URingQueue();
+
+  // Whether the constructor got a ring from the kernel
+  bool   IsOpen() const { return ringfd>=0; }
+
+  void   Start(const vector<DiskRequest *> &reqs);
+  void   Wait(vector<DiskRequest *> &done, const SIZE_T min);
+  string GetName() const { return "uring"; }
+};
+
+
+// A pool of depth threads, each doing one request at a time
+class ThreadPoolQueue : public DiskQueue {
+ private:
+  vector<pthread_t> threads;
+  pthread_mutex_t   lock;
+  pthread_cond_t    work;
+  pthread_cond_t    finished;
+  // Protected by lock
+  deque<DiskRequest *> pending;
+  vector<DiskRequest *> completed;
+  bool              shutdown;
+
+  static void *WorkerMain(void *queue);
+  void   Worker();
+ public:
+  ThreadPoolQueue(const int fd, const SIZE_T depth);
+  ~ThreadPoolQueue();
+
+  void   Start(const vector<DiskRequest *> &reqs);
+  void   Wait(vector<DiskRequest *> &done, const SIZE_T min);
+  string GetName() const { return "threads"; }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#include "diskscheduler.h"
+
+const double DeadlineScheduler::READEXPIRE=500;
+const double DeadlineScheduler::WRITEEXPIRE=5000;
+
+
+void DiskScheduler::Count(const DiskRequest *req, const SIZE_T tracks, const double now)
+{
+  numrequests++;
+  seektracks+=tracks;
+  servicetime+=req->reqtime;
+  waittime+=now-req->arrival;
+}
+
+double DiskScheduler::GetAverageSeek() const
+{
+  return numrequests>0 ? seektracks/numrequests : 0;
+}
+
+double DiskScheduler::GetAverageServiceTime() const
+{
+  return numrequests>0 ? servicetime/numrequests : 0;
+}
+
+double DiskScheduler::GetAverageWait() const
+{
+  return numrequests>0 ? waittime/numrequests : 0;
+}
+
+ostream & DiskScheduler::PrintStats(ostream &os) const
+{
+  os << "scheduler       = "<<GetName()<<endl;
+  os << "schedrequests   = "<<numrequests<<endl;
+  os << "schedavgseek    = "<<GetAverageSeek()<<" tracks"<<endl;
+  os << "schedavgservice = "<<GetAverageServiceTime()<<endl;
+  os << "schedavgwait    = "<<GetAverageWait()<<endl;
+  return os;
+}
+
+DiskScheduler *DiskScheduler::Create(const string &name)
+{
+  if (name=="fifo") {
+    return new FIFOScheduler();
+  } else if (name=="scan") {
+    return new SCANScheduler();
+  } else if (name=="clook") {
+    return new CLOOKScheduler();
+  } else if (name=="deadline") {
+    return new DeadlineScheduler();
+  } else {
+    return 0;
+  }
+}
+
+bool DiskScheduler::IsValidName(const string &name)
+{
+  return name=="fifo" || name=="scan" || name=="clook" || name=="deadline";
+}
+
+void DiskScheduler::PrintNames(ostream &os)
+{
+  os << "fifo, scan, clook, or deadline";
+}
+
+
+void FIFOScheduler::Add(DiskRequest *req)
+{
+  waiting.push_back(req);
+}
+
+DiskRequest *FIFOScheduler::Next(const SIZE_T head, const double now)
+{
+  if (waiting.empty()) {
+    return 0;
+  }
+  DiskRequest *req=waiting.front();
+  waiting.pop_front();
+  return req;
+}
+
+
+void SCANScheduler::Add(DiskRequest *req)
+{
+  waiting.insert(pair<SIZE_T, DiskRequest *>(req->blocknum,req));
+}
+
+DiskRequest *SCANScheduler::Next(const SIZE_T head, const double now)
+{
+  if (waiting.empty()) {
+    return 0;
+  }
+
+  multimap<SIZE_T, DiskRequest *>::iterator i;
+
+  if (up) {
+    i=waiting.lower_bound(head);
+    if (i==waiting.end()) {
+      // nothing further up, so turn around
+      up=false;
+      --i;
+    }
+  } else {
+    i=waiting.upper_bound(head);
+    if (i==waiting.begin()) {
+      up=true;
+    } else {
+      --i;
+      // the first of the requests for this block
+      i=waiting.lower_bound(i->first);
+    }
+  }
+
+  DiskRequest *req=i->second;
+  waiting.erase(i);
+  return req;
+}
+
+
+void CLOOKScheduler::Add(DiskRequest *req)
+{
+  waiting.insert(pair<SIZE_T, DiskRequest *>(req->blocknum,req));
+}
+
+DiskRequest *CLOOKScheduler::Next(const SIZE_T head, const double now)
+{
+  if (waiting.empty()) {
+    return 0;
+  }
+
+  multimap<SIZE_T, DiskRequest *>::iterator i=waiting.lower_bound(head);
+
+  if (i==waiting.end()) {
+    i=waiting.begin();
+  }
+
+  DiskRequest *req=i->second;
+  waiting.erase(i);
+  return req;
+}
+
+
+void DeadlineScheduler::Add(DiskRequest *req)
+{
+  CLOOKScheduler::Add(req);
+  (req->write ? writes : reads).push_back(req);
+}
+
+void DeadlineScheduler::Forget(DiskRequest *req)
+{
+  pair<multimap<SIZE_T, DiskRequest *>::iterator,
+       multimap<SIZE_T, DiskRequest *>::iterator> r=waiting.equal_range(req->blocknum);
+
+  for (multimap<SIZE_T, DiskRequest *>::iterator i=r.first; i!=r.second; ++i) {
+    if (i->second==req) {
+      waiting.erase(i);
+      return;
+    }
+  }
+}
+
+DiskRequest *DeadlineScheduler::Next(const SIZE_T head, const double now)
+{
+  DiskRequest *req;
+
+  if (!reads.empty() && now-reads.front()->arrival>READEXPIRE) {
+    req=reads.front();
+    reads.pop_front();
+    Forget(req);
+    return req;
+  }
+  if (!writes.empty() && now-writes.front()->arrival>WRITEEXPIRE) {
+    req=writes.front();
+    writes.pop_front();
+    Forget(req);
+    return req;
+  }
+
+  req=CLOOKScheduler::Next(head,now);
+  if (req) {
+    (req->write ? writes : reads).remove(req);
+  }
+  return req;
+}
@@ -0,0 +1,116 @@
+#ifndef _diskscheduler
+#define _diskscheduler
+
+#include <iostream>
+#include <string>
+#include <deque>
+#include <list>
+#include <map>
+
+#include "global.h"
+#include "diskqueue.h"
+
+using namespace std;
+
+//
+// Orders the requests waiting for the simulated disk.  DiskSystem
+// adds each request it is given (Add) and, whenever the disk is free,
+// asks for the one to serve next (Next), telling the scheduler the
+// block the head is over and the disk's clock, which advances by the
+// time of each request it serves.  The scheduler also keeps
+// statistics on the requests it has handed out.
+//
+class DiskScheduler {
+ protected:
+  SIZE_T numrequests;
+  double seektracks;
+  double servicetime;
+  double waittime;
+ public:
+  DiskScheduler() : numrequests(0), seektracks(0), servicetime(0), waittime(0) {}
+  virtual ~DiskScheduler() {}
+
+  virtual void   Add(DiskRequest *req)=0;
+  // Removes and returns the next request to serve, or 0 if none wait
+  virtual DiskRequest *Next(const SIZE_T head, const double now)=0;
+  virtual bool   IsEmpty() const=0;
+  virtual string GetName() const=0;
+
+  // DiskSystem reports each request it serves, with how many tracks
+  // the head moved to reach it and when it started
+  void   Count(const DiskRequest *req, const SIZE_T tracks, const double now);
+
+  SIZE_T GetNumRequests() const { return numrequests; }
+  // Averages over the requests served
+  double GetAverageSeek() const;
+  double GetAverageServiceTime() const;
+  double GetAverageWait() const;
+  ostream & PrintStats(ostream &os) const;
+
+  // Schedulers are named fifo, scan, clook, or deadline
+  // returns 0 if the name is not recognized
+  static DiskScheduler *Create(const string &name);
+  static bool IsValidName(const string &name);
+  static void PrintNames(ostream &os);
+};
+
+
+// In the order they arrive
+class FIFOScheduler : public DiskScheduler {
+ private:
+  deque<DiskRequest *> waiting;
+ public:
+  void   Add(DiskRequest *req);
+  DiskRequest *Next(const SIZE_T head, const double now);
+  bool   IsEmpty() const { return waiting.empty(); }
+  string GetName() const { return "fifo"; }
+};
+
+
+// The elevator: the head sweeps up through the waiting blocks, then
+// back down, turning at the last request rather than the end of the
+// disk (strictly, LOOK)
+class SCANScheduler : public DiskScheduler {
+ private:
+  multimap<SIZE_T, DiskRequest *> waiting;
+  bool up;
+ public:
+  SCANScheduler() : up(true) {}
+  void   Add(DiskRequest *req);
+  DiskRequest *Next(const SIZE_T head, const double now);
+  bool   IsEmpty() const { return waiting.empty(); }
+  string GetName() const { return "scan"; }
+};
+
+
+// Sweeps only upward, going back to the lowest waiting block after
+// the highest, since on this disk going back against the rotation
+// costs almost a full turn
+class CLOOKScheduler : public DiskScheduler {
+ protected:
+  multimap<SIZE_T, DiskRequest *> waiting;
+ public:
+  void   Add(DiskRequest *req);
+  DiskRequest *Next(const SIZE_T head, const double now);
+  bool   IsEmpty() const { return waiting.empty(); }
+  string GetName() const { return "clook"; }
+};
+
+
+// C-LOOK, except that a request waiting longer than its expiry time
+// (as in Linux's deadline scheduler, 500 ms for reads and 5 s for
+// writes) is served first, oldest reads before writes
+class DeadlineScheduler : public CLOOKScheduler {
+ private:
+  static const double READEXPIRE;
+  static const double WRITEEXPIRE;
+  list<DiskRequest *> reads, writes;
+
+  void   Forget(DiskRequest *req);
+ public:
+  void   Add(DiskRequest *req);
+  DiskRequest *Next(const SIZE_T head, const double now);
+  string GetName() const { return "deadline"; }
+};
+
+#endif
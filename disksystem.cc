@@ -1,13 +1,28 @@
+// off_t is 64 bits even where long is not
+#define _FILE_OFFSET_BITS 64
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 
 #include <math.h>
 
+#include <sstream>
+
 #include "disksystem.h"
+#include "bitmap.h"
+#include "flashdisk.h"
+#include "arraydisk.h"
+#include "trace.h"
 
 
 static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int len)
@@ -71,6 +86,105 @@ static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool
 }
 
 
+// The data file is accessed with positioned reads and writes, which
+// need no seek, don't go through stdio's buffer, and are restarted
+// where they left off if interrupted or cut short.  Reading past the
+// end of the file gives zeros, as if the file had been extended to
+// cover every block.
+static bool readall(const int fd, off_t off, BYTE_T *buf, size_t len)
+{
+  while (len>0) {
+    ssize_t got=pread(fd,buf,len,off);
+    if (got<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      return false;
+    } else if (got==0) {
+      memset(buf,0,len);
+      return true;
+    }
+    buf+=got;
+    off+=got;
+    len-=got;
+  }
+  return true;
+}
+
+static bool writeall(const int fd, off_t off, const BYTE_T *buf, size_t len)
+{
+  while (len>0) {
+    ssize_t sent=pwrite(fd,buf,len,off);
+    if (sent<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      return false;
+    } else if (sent==0) {
+      return false;
+    }
+    buf+=sent;
+    off+=sent;
+    len-=sent;
+  }
+  return true;
+}
+
+// Drops the first done bytes from an iovec array
+static void skipiov(struct iovec *&iov, int &n, size_t done)
+{
+  while (n>0 && done>=iov->iov_len) {
+    done-=iov->iov_len;
+    iov++;
+    n--;
+  }
+  if (n>0) {
+    iov->iov_base=(BYTE_T *)iov->iov_base+done;
+    iov->iov_len-=done;
+  }
+}
+
+// The same for a series of buffers, at most IOV_MAX per call
+static bool readallv(const int fd, off_t off, struct iovec *iov, int n)
+{
+  while (n>0) {
+    ssize_t got=preadv(fd,iov,n<IOV_MAX ? n : IOV_MAX,off);
+    if (got<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      return false;
+    } else if (got==0) {
+      for (int i=0;i<n;i++) {
+	memset(iov[i].iov_base,0,iov[i].iov_len);
+      }
+      return true;
+    }
+    off+=got;
+    skipiov(iov,n,got);
+  }
+  return true;
+}
+
+static bool writeallv(const int fd, off_t off, struct iovec *iov, int n)
+{
+  while (n>0) {
+    ssize_t sent=pwritev(fd,iov,n<IOV_MAX ? n : IOV_MAX,off);
+    if (sent<0) {
+      if (errno==EINTR) {
+	continue;
+      }
+      return false;
+    } else if (sent==0) {
+      return false;
+    }
+    off+=sent;
+    skipiov(iov,n,sent);
+  }
+  return true;
+}
+
+
 DiskSystem::DiskSystem(const string &filestem,
 		       const bool   create,
 		       const SIZE_T offset,
@@ -81,9 +195,23 @@ DiskSystem::DiskSystem(const string &filestem,
 		       const SIZE_T tracks,
 		       const double avgseek,
 		       const double trackseek,
-		       const double rotlat) :
+		       const double rotlat,
+		       const string &backend) :
   bitmap(0),
-  datafilefd(0),
+  datafd(-1),
+  backend(backend),
+  datamap(0),
+  datamaplen(0),
+  datamapskip(0),
+  bitmapmapped(false),
+  bitmapdirtylo(0),
+  bitmapdirtyhi(0),
+  queue(0),
+  outstanding(0),
+  inqueue(0),
+  scheduler(DiskScheduler::Create("fifo")),
+  disktime(0),
+  trace(0),
   configfilefd(0),
   bitmapfilefd(0),
   diskfilestem(filestem), 
@@ -97,7 +225,8 @@ DiskSystem::DiskSystem(const string &filestem,
   last_sector(0),
   averageseeklatency(avgseek),
   trackseeklatency(trackseek),
-  rotationallatency(rotlat)
+  rotationallatency(rotlat),
+  model("disk")
 {
   if (create) { 
     // Only in this case are the parameters used:
@@ -109,12 +238,31 @@ DiskSystem::DiskSystem(const string &filestem,
 
 DiskSystem::~DiskSystem()
 {
+  vector<DiskRequest *> done;
+
+  Complete(done,outstanding);
+  delete queue;
+  delete scheduler;
   WriteConfig();
   WriteBitMap();
+  if (datamap) { 
+    if (backend!="ram") { 
+      msync(datamap,datamaplen,MS_SYNC);
+    }
+    munmap(datamap,datamaplen);
+  }
   fclose(configfilefd);
-  fclose(bitmapfilefd);
-  fclose(datafilefd);
-  delete [] bitmap;
+  if (bitmapfilefd) { 
+    fclose(bitmapfilefd);
+  }
+  if (datafd>=0) { 
+    close(datafd);
+  }
+  if (bitmapmapped) { 
+    munmap(bitmap,numblocks / 8 + (numblocks%8 != 0));
+  } else {
+    delete [] bitmap;
+  }
 }
 
 ERROR_T DiskSystem::SanityCheckConfig()
@@ -127,6 +275,14 @@ ERROR_T DiskSystem::SanityCheckConfig()
     cerr << "Geometry mismatch.\n";
     return ERROR_BADCONFIG;
   }
+  if (backend!="file" && backend!="mmap" && backend!="ram") { 
+    cerr << "Unknown backend "<<backend<<".\n";
+    return ERROR_BADCONFIG;
+  }
+  if (!IsValidModel(model)) { 
+    cerr << "Unknown model "<<model<<".\n";
+    return ERROR_BADCONFIG;
+  }
 
   return ERROR_NOERROR;
 }
@@ -157,6 +313,14 @@ ERROR_T DiskSystem::WriteConfig()
   fprintf(configfilefd,"%lf\n",trackseeklatency);
   fprintf(configfilefd,"# rotationalatency\n");
   fprintf(configfilefd,"%lf\n",rotationallatency);
+  fprintf(configfilefd,"# backend\n");
+  fprintf(configfilefd,"%s\n",backend.c_str());
+  fprintf(configfilefd,"# model\n");
+  fprintf(configfilefd,"%s\n",model.c_str());
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    fprintf(configfilefd,"# %s\n",modelparams[i].first.c_str());
+    fprintf(configfilefd,"%s\n",modelparams[i].second.c_str());
+  }
   fflush(configfilefd);
 
   return ERROR_NOERROR;
@@ -196,6 +360,29 @@ ERROR_T DiskSystem::ReadConfig()
   PARSEDOUBLE(&trackseeklatency);
   GETNEXTVAL;
   PARSEDOUBLE(&rotationallatency);
+  // Disks made before there was a choice of backend end here, and
+  // those made before there was a choice of model after the backend.
+  // Each value that follows is named by the comment before it.
+  backend="file";
+  model="disk";
+  modelparams.clear();
+
+  string name;
+
+  while (fgets(buf,80,configfilefd)) { 
+    if (buf[strlen(buf)-1]=='\n') { 
+      buf[strlen(buf)-1]=0;
+    }
+    if (buf[0]=='#') { 
+      name=string(buf+1+strspn(buf+1," "));
+    } else if (name=="model") { 
+      model=string(buf);
+    } else if (name=="backend" || name=="") { 
+      backend=string(buf);
+    } else {
+      modelparams.push_back(pair<string, string>(name,string(buf)));
+    }
+  }
 
   return ERROR_NOERROR;
 }
@@ -203,19 +390,53 @@ ERROR_T DiskSystem::ReadConfig()
 
 ERROR_T DiskSystem::WriteBitMap()
 {
-  rewind(bitmapfilefd);
-  
   SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
 
-  if (mywrite(bitmapfilefd,0,bitmap,numbitmapbytes)!=numbitmapbytes) { 
+  if (backend=="ram") { 
+    // there is nowhere to write it
+    return ERROR_NOERROR;
+  }
+
+  // Only the bytes changed since the last write go out
+  if (bitmapdirtylo>=bitmapdirtyhi) { 
+    return ERROR_NOERROR;
+  }
+
+  if (bitmapmapped) { 
+    SIZE_T start = bitmapdirtylo - bitmapdirtylo%sysconf(_SC_PAGESIZE);
+    if (msync(bitmap+start,bitmapdirtyhi-start,MS_SYNC)) { 
+      cerr << "Can't sync bitmap file\n";
+      return ERROR_IMPLBUG;
+    }
+  } else if (mywrite(bitmapfilefd,bitmapdirtylo,bitmap+bitmapdirtylo,bitmapdirtyhi-bitmapdirtylo)!=bitmapdirtyhi-bitmapdirtylo) { 
     cerr << "Can't write bitmap file\n";
     return ERROR_IMPLBUG;
   }
+
+  bitmapdirtylo=numbitmapbytes;
+  bitmapdirtyhi=0;
   return ERROR_NOERROR;
 }
 
+void DiskSystem::MarkBitMapDirty(const SIZE_T first, const SIZE_T num)
+{
+  if (num==0) { 
+    return;
+  }
+  if (first/8<bitmapdirtylo || bitmapdirtylo>=bitmapdirtyhi) { 
+    bitmapdirtylo=first/8;
+  }
+  if ((first+num-1)/8+1>bitmapdirtyhi) { 
+    bitmapdirtyhi=(first+num-1)/8+1;
+  }
+}
+
 ERROR_T DiskSystem::ReadBitMap()
 {
+  if (backend=="mmap") { 
+    return MapBitMap();
+  }
+
   rewind(bitmapfilefd);
   
   SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
@@ -257,10 +478,25 @@ ERROR_T DiskSystem::InitFromConfigFile()
     return rc;
   }
 
-  if (datafilefd) { fclose(datafilefd);}
+  if (backend=="ram") { 
+    SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
 
-  if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
-    return ERROR_NOFILE;
+    bitmap = new BYTE_T [numbitmapbytes];
+    memset(bitmap,0,numbitmapbytes);
+    return AllocateRAM();
+  }
+
+  rc = OpenDataFile(dataname,false);
+
+  if (rc) { 
+    return rc;
+  }
+
+  if (backend=="mmap") { 
+    rc = MapDataFile();
+    if (rc) { 
+      return rc;
+    }
   }
 
 
@@ -329,6 +565,11 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
   bitmap = new BYTE_T [numbitmapbytes];
 
   memset(bitmap,0,numbitmapbytes);
+  MarkBitMapDirty(0,numblocks);
+
+  if (backend=="ram") { 
+    return AllocateRAM();
+  }
 
   // create the bitmap file and write out the bitmap
 
@@ -344,28 +585,218 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
     return rc;
   }
 
+  if (backend=="mmap") { 
+    rc = MapBitMap();
+    if (rc) { 
+      return rc;
+    }
+  }
+
   // Now we'll open the data file
   // notice that we will REUSE an existing data file if it exists
   // The idea is that we will write only from offset to offset+blocksize*numblocks
 
-  if (datafilefd) { fclose(datafilefd);}
+  rc = OpenDataFile(dataname,true);
 
-  if (stat(dataname.c_str(),&s)!=-1) { 
-    // reuse existing datafile
-    if ((datafilefd = fopen(dataname.c_str(),"r+"))==0) { 
-      return ERROR_NOFILE;
-    }
+  if (rc) { 
+    return rc;
+  }
+
+  if (backend=="mmap") { 
+    return MapDataFile();
+  }
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T DiskSystem::OpenDataFile(const string &dataname, const bool create)
+{
+  if (datafd>=0) { close(datafd); }
+
+  // An existing data file is used as it is, never truncated
+  if ((datafd = open(dataname.c_str(),O_RDWR | (create ? O_CREAT : 0),0666))<0) { 
+    return ERROR_NOFILE;
+  }
+
+  return ERROR_NOERROR;
+}
+
+
+long long DiskSystem::DataOffset(const SIZE_T block) const
+{
+  return (long long)offset+(long long)block*blocksize;
+}
+
+
+BYTE_T *DiskSystem::MappedBlock(const SIZE_T block) const
+{
+  return datamap+datamapskip+(size_t)block*blocksize;
+}
+
+
+ERROR_T DiskSystem::MapDataFile()
+{
+  // The mapping must start on a page, which offset need not be
+  off_t  end = DataOffset(numblocks);
+  off_t  start = offset - offset%sysconf(_SC_PAGESIZE);
+  struct stat s;
+
+  // Blocks never written are holes, so this costs no space
+  if (fstat(datafd,&s) || (s.st_size<end && ftruncate(datafd,end))) { 
+    cerr << "Can't extend data file\n";
+    return ERROR_NOFILE;
+  }
+
+  datamapskip = offset-start;
+  datamaplen = end-start;
+
+  void *m = mmap(0,datamaplen,PROT_READ|PROT_WRITE,MAP_SHARED,datafd,start);
+
+  if (m==MAP_FAILED) { 
+    cerr << "Can't map data file\n";
+    datamaplen=0;
+    return ERROR_NOMEM;
+  }
+  datamap=(BYTE_T *)m;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T DiskSystem::AllocateRAM()
+{
+  datamapskip = 0;
+  datamaplen = (size_t)numblocks*blocksize;
+
+  if (datamaplen==0) { 
+    return ERROR_NOERROR;
+  }
+
+  // Pages are zero until first written, and only then take memory
+  void *m = mmap(0,datamaplen,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+
+  if (m==MAP_FAILED) { 
+    cerr << "Can't allocate memory for the disk\n";
+    datamaplen=0;
+    return ERROR_NOMEM;
+  }
+  datamap=(BYTE_T *)m;
+
+  return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::MapBitMap()
+{
+  SIZE_T numbitmapbytes = numblocks / 8 + (numblocks%8 != 0); 
+  struct stat s;
+
+  // the bitmap may have just been written through stdio
+  fflush(bitmapfilefd);
+  if (fstat(fileno(bitmapfilefd),&s) || (size_t)s.st_size<numbitmapbytes) { 
+    cerr << "Can't read bitmap file\n";
+    return ERROR_IMPLBUG;
+  }
+
+  void *m = mmap(0,numbitmapbytes,PROT_READ|PROT_WRITE,MAP_SHARED,fileno(bitmapfilefd),0);
+
+  if (m==MAP_FAILED) { 
+    cerr << "Can't map bitmap file\n";
+    return ERROR_NOMEM;
+  }
+  if (bitmapmapped) { 
+    munmap(bitmap,numbitmapbytes);
   } else {
-    // create new data file
-    if ((datafilefd = fopen(dataname.c_str(),"w+"))==0) { 
-      return ERROR_NOFILE;
-    }
+    delete [] bitmap;
   }
+  bitmap=(BYTE_T *)m;
+  bitmapmapped=true;
 
   return ERROR_NOERROR;
 }
 
 
+ERROR_T DiskSystem::Sync()
+{
+  if (datamap && backend!="ram" && msync(datamap,datamaplen,MS_SYNC)) { 
+    cerr << "DiskSystem::Sync: msync has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
+
+  return WriteBitMap();
+}
+
+
+const string &DiskSystem::GetBackend() const
+{
+  return backend;
+}
+
+const string &DiskSystem::GetModel() const
+{
+  return model;
+}
+
+ostream & DiskSystem::PrintModelStats(ostream &os) const
+{
+  return os;
+}
+
+double DiskSystem::GetModelParam(const string &name, const double def)
+{
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    if (modelparams[i].first==name) { 
+      return atof(modelparams[i].second.c_str());
+    }
+  }
+
+  ostringstream value;
+
+  value << def;
+  modelparams.push_back(pair<string, string>(name,value.str()));
+  return def;
+}
+
+
+bool DiskSystem::IsValidModel(const string &name)
+{
+  return name=="disk" || name=="flash" || name=="array";
+}
+
+DiskSystem *DiskSystem::Open(const string &filestem)
+{
+  string configname = filestem + ".config";
+  FILE *f = fopen(configname.c_str(),"r");
+  char buf[80];
+  bool named=false;
+  string name = "disk";
+
+  // Only the model is wanted here; the disk reads the rest itself
+  while (f && fgets(buf,80,f)) { 
+    if (buf[strlen(buf)-1]=='\n') { 
+      buf[strlen(buf)-1]=0;
+    }
+    if (buf[0]=='#') { 
+      named = string(buf)=="# model";
+    } else if (named) { 
+      name=string(buf);
+      break;
+    }
+  }
+  if (f) { 
+    fclose(f);
+  }
+
+  if (name=="flash") { 
+    return new FlashDiskSystem(filestem);
+  } else if (name=="array") { 
+    return new ArrayDiskSystem(filestem);
+  } else {
+    return new DiskSystem(filestem);
+  }
+}
+
+
 
     
 
@@ -373,7 +804,7 @@ ERROR_T DiskSystem::InitFromInMemoryConfig()
 // Note, this assumes disk is kept continously busy
 // or that time does not advance except during a disk op
 //
-double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) 
+double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write) 
 {
 
   SIZE_T req_trackstart = (offblock) / (numheads*blockspertrack);
@@ -425,20 +856,31 @@ ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  reqtime=ModelAccess(inoffblock,numblock,false);
+  Served(inoffblock,numblock,false,reqtime);
+
+  // Read straight into the new blocks, all in one request
+  SIZE_T first=blocks.size();
+  vector<struct iovec> iov(numblock);
 
+  blocks.resize(first+numblock,Block(blocksize));
   for (SIZE_T i=0;i<numblock;i++) { 
-    Block b(blocksize);
     if (!IsBlockAllocated(inoffblock+i)) { 
       if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
 	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (myread(datafilefd,offset+(inoffblock+i)*blocksize,b.data,blocksize,true)!=blocksize) { 
-      cerr << "DiskSystem::Read: myread has failed"<<endl;
-      return ERROR_IMPLBUG;
+    iov[i].iov_base=blocks[first+i].data;
+    iov[i].iov_len=blocksize;
+  }
+
+  if (datamap) { 
+    for (SIZE_T i=0;i<numblock;i++) { 
+      memcpy(iov[i].iov_base,MappedBlock(inoffblock+i),blocksize);
     }
-    blocks.push_back(b);
+  } else if (numblock>0 && !readallv(datafd,DataOffset(inoffblock),&iov[0],numblock)) { 
+    cerr << "DiskSystem::Read: preadv has failed"<<endl;
+    return ERROR_IMPLBUG;
   }
 
   return ERROR_NOERROR;
@@ -456,7 +898,10 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
     return ERROR_NOSPACE;
   }
 
-  reqtime=ModelAccess(inoffblock,numblock);
+  reqtime=ModelAccess(inoffblock,numblock,true);
+  Served(inoffblock,numblock,true,reqtime);
+
+  vector<struct iovec> iov(numblock);
 
   for (SIZE_T i=0;i<numblock;i++) { 
     if (!IsBlockAllocated(inoffblock+i)) { 
@@ -464,10 +909,17 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
 	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
       }
     }
-    if (mywrite(datafilefd,offset+(inoffblock+i)*blocksize,blocks[i].data,blocksize)!=blocksize) {  
-      cerr << "DiskSystem::Write: mywrite has failed"<<endl;
-      return ERROR_IMPLBUG;
+    iov[i].iov_base=blocks[i].data;
+    iov[i].iov_len=blocksize;
+  }
+
+  if (datamap) { 
+    for (SIZE_T i=0;i<numblock;i++) { 
+      memcpy(MappedBlock(inoffblock+i),iov[i].iov_base,blocksize);
     }
+  } else if (numblock>0 && !writeallv(datafd,DataOffset(inoffblock),&iov[0],numblock)) {  
+    cerr << "DiskSystem::Write: pwritev has failed"<<endl;
+    return ERROR_IMPLBUG;
   }
 
   return ERROR_NOERROR;
@@ -476,35 +928,298 @@ ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
 
 ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime)
 {
-  vector<Block> bl;
+  if (blocks.length!=blocksize && blocks.Resize(blocksize,false)!=ERROR_NOERROR) { 
+    return ERROR_NOMEM;
+  }
 
-  ERROR_T rc = Read(inoffblock,1,bl,reqtime);
+  return Read(inoffblock,1,blocks.data,reqtime);
+}
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+{
+  if (blocks.length<blocksize) { 
+    return ERROR_WRONGSIZEBLOCK;
   }
 
-  blocks = bl[0];
+  return Write(inoffblock,1,blocks.data,reqtime);
+}
+
+
+ERROR_T DiskSystem::Read(const SIZE_T   inoffblock,
+			 const SIZE_T   numblock,
+			 BYTE_T        *data,
+			 double        &reqtime)
+{
+  reqtime=0;
+
+  if (inoffblock+numblock > numblocks) {
+    cerr << "DiskSystem::Read: Attempt to read blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
+
+  reqtime=ModelAccess(inoffblock,numblock,false);
+  Served(inoffblock,numblock,false,reqtime);
+
+  for (SIZE_T i=0;i<numblock;i++) {
+    if (!IsBlockAllocated(inoffblock+i)) {
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Read: reading unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+
+  if (Transfer(false,inoffblock,numblock,data)!=ERROR_NOERROR) {
+    cerr << "DiskSystem::Read: pread has failed"<<endl;
+    return ERROR_IMPLBUG;
+  }
 
   return ERROR_NOERROR;
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime)
+ERROR_T DiskSystem::Write(const SIZE_T   inoffblock,
+			  const SIZE_T   numblock,
+			  const BYTE_T  *data,
+			  double        &reqtime)
 {
-  vector<Block> bl;
+  reqtime=0;
 
-  bl.push_back(blocks);
+  if (inoffblock+numblock > numblocks) {
+    cerr << "DiskSystem::Write: Attempt to write blocks "<<inoffblock<<" to "<<(inoffblock+numblock-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+    return ERROR_NOSPACE;
+  }
 
-  ERROR_T rc = Write(inoffblock,1,bl,reqtime);
+  reqtime=ModelAccess(inoffblock,numblock,true);
+  Served(inoffblock,numblock,true,reqtime);
 
-  if (rc!=ERROR_NOERROR) { 
-    return rc;
+  for (SIZE_T i=0;i<numblock;i++) {
+    if (!IsBlockAllocated(inoffblock+i)) {
+      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	cerr <<"DiskSystem::Write: writing unallocated block "<<(i+inoffblock)<<endl;
+      }
+    }
+  }
+
+  if (Transfer(true,inoffblock,numblock,(BYTE_T *)data)!=ERROR_NOERROR) {
+    cerr << "DiskSystem::Write: pwrite has failed"<<endl;
+    return ERROR_IMPLBUG;
   }
 
   return ERROR_NOERROR;
 }
 
 
+ERROR_T DiskSystem::Transfer(const bool    write,
+			     const SIZE_T  block,
+			     const SIZE_T  num,
+			     BYTE_T       *data,
+			     const size_t  done)
+{
+  size_t len=(size_t)num*blocksize-done;
+  bool   ok;
+
+  if (datamap) {
+    if (write) {
+      memcpy(MappedBlock(block)+done,data+done,len);
+    } else {
+      memcpy(data+done,MappedBlock(block)+done,len);
+    }
+    return ERROR_NOERROR;
+  }
+
+  if (write) {
+    ok=writeall(datafd,DataOffset(block)+done,data+done,len);
+  } else {
+    ok=readall(datafd,DataOffset(block)+done,data+done,len);
+  }
+  return ok ? ERROR_NOERROR : ERROR_IMPLBUG;
+}
+
+
+ERROR_T DiskSystem::Submit(const vector<DiskRequest *> &reqs)
+{
+  DiskRequest *req;
+  SIZE_T order=0;
+
+  for (vector<DiskRequest *>::const_iterator i=reqs.begin(); i!=reqs.end(); ++i) {
+    req=*i;
+    req->reqtime=0;
+    req->rc=ERROR_NOERROR;
+    req->result=0;
+    outstanding++;
+
+    if (req->blocknum+req->numblocks > numblocks) {
+      cerr << "DiskSystem::Submit: Attempt to access blocks "<<req->blocknum<<" to "<<(req->blocknum+req->numblocks-1)<<", but maxmimum block is only "<<(numblocks-1)<<endl;
+      req->rc=ERROR_NOSPACE;
+      req->order=order++;
+      finished.push_back(req);
+      continue;
+    }
+    req->arrival=disktime;
+    scheduler->Add(req);
+  }
+
+  while ((req=scheduler->Next(GetHeadBlock(),disktime))!=0) {
+    SIZE_T track=req->blocknum/(numheads*blockspertrack);
+    SIZE_T tracks = track>last_track ? track-last_track : last_track-track;
+
+    req->reqtime=ModelAccess(req->blocknum,req->numblocks,req->write);
+    req->order=order++;
+    scheduler->Count(req,tracks,disktime);
+    Served(req->blocknum,req->numblocks,req->write,req->reqtime);
+
+    for (SIZE_T b=req->blocknum;b<req->blocknum+req->numblocks;b++) {
+      if (!IsBlockAllocated(b)) {
+	if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+	  cerr <<"DiskSystem::Submit: accessing unallocated block "<<b<<endl;
+	}
+      }
+    }
+
+    req->offset=DataOffset(req->blocknum);
+    req->length=(size_t)req->numblocks*blocksize;
+
+    // a mapping is just memory, so there is nothing to wait for
+    if (!queue || datamap) {
+      Finish(req);
+      continue;
+    }
+
+    waiting.push_back(req);
+  }
+
+  StartWaiting();
+
+  return ERROR_NOERROR;
+}
+
+
+void DiskSystem::StartWaiting()
+{
+  vector<DiskRequest *> start;
+
+  while (!waiting.empty() && inqueue+start.size()<queue->GetDepth()) {
+    start.push_back(waiting.front());
+    waiting.pop_front();
+  }
+  if (!start.empty()) {
+    queue->Start(start);
+    inqueue+=start.size();
+  }
+}
+
+
+void DiskSystem::Finish(DiskRequest *req)
+{
+  // whatever the queue didn't do, including all of a request it
+  // failed or couldn't do at all, is done here
+  size_t done = req->result>0 ? req->result : 0;
+
+  if (done<req->length &&
+      Transfer(req->write,req->blocknum,req->numblocks,req->data,done)!=ERROR_NOERROR) {
+    cerr << "DiskSystem::Finish: "<<(req->write ? "pwrite" : "pread")<<" has failed"<<endl;
+    req->rc=ERROR_IMPLBUG;
+  }
+  finished.push_back(req);
+}
+
+
+void DiskSystem::Reap(const SIZE_T min)
+{
+  vector<DiskRequest *> done;
+
+  queue->Wait(done,min);
+  inqueue-=done.size();
+  for (vector<DiskRequest *>::const_iterator i=done.begin(); i!=done.end(); ++i) {
+    Finish(*i);
+  }
+  StartWaiting();
+}
+
+
+void DiskSystem::Complete(vector<DiskRequest *> &done, const SIZE_T min)
+{
+  SIZE_T want = min<outstanding ? min : outstanding;
+
+  while (finished.size()<want) {
+    Reap(want-finished.size()<inqueue ? want-finished.size() : inqueue);
+  }
+  done.insert(done.end(),finished.begin(),finished.end());
+  outstanding-=finished.size();
+  finished.clear();
+}
+
+
+SIZE_T DiskSystem::GetNumOutstanding() const
+{
+  return outstanding;
+}
+
+
+ERROR_T DiskSystem::SetQueueDepth(const SIZE_T depth, const string &engine)
+{
+  if (outstanding>0 || depth<1 || !DiskQueue::IsValidEngine(engine)) {
+    return ERROR_GENERAL;
+  }
+
+  DiskQueue *q=0;
+
+  // make the new queue first, so a failure leaves the old one in place
+  if (depth>1 && (q=DiskQueue::Create(engine,datafd,depth))==0) {
+    return ERROR_GENERAL;
+  }
+  delete queue;
+  queue=q;
+
+  return ERROR_NOERROR;
+}
+
+
+ERROR_T DiskSystem::SetScheduler(const string &name)
+{
+  DiskScheduler *s=DiskScheduler::Create(name);
+
+  if (!s) {
+    return ERROR_GENERAL;
+  }
+  delete scheduler;
+  scheduler=s;
+
+  return ERROR_NOERROR;
+}
+
+
+const DiskScheduler *DiskSystem::GetScheduler() const
+{
+  return scheduler;
+}
+
+
+SIZE_T DiskSystem::GetQueueDepth() const
+{
+  return queue ? queue->GetDepth() : 1;
+}
+
+
+string DiskSystem::GetQueueEngine() const
+{
+  return queue ? queue->GetName() : "sync";
+}
+
+void DiskSystem::SetTrace(TraceWriter *t)
+{
+  trace=t;
+}
+
+void DiskSystem::Served(const SIZE_T off, const SIZE_T num, const bool write, const double reqtime)
+{
+  if (trace) {
+    trace->Record(write ? TRACE_DISKWRITE : TRACE_DISKREAD,off,num,disktime,disktime+reqtime);
+  }
+  disktime+=reqtime;
+}
+
+
+
 SIZE_T DiskSystem::GetBlockSize() const
 {
   return blocksize;
@@ -515,11 +1230,14 @@ SIZE_T DiskSystem::GetNumBlocks() const
   return numblocks;
 }
 
+SIZE_T DiskSystem::GetHeadBlock() const
+{
+  return last_track*numheads*blockspertrack+last_sector;
+}
+
 
 
 #define GETBIT(x) ((bitmap[(x)/8] >> (7-((x)%8))) & 0x1)
-#define SETBIT(x) do { bitmap[(x)/8] |= 0x1 << (7-((x)%8)); } while (0)
-#define CLEARBIT(x) do { bitmap[(x)/8] &= ~(0x1 << (7-((x)%8))); } while (0)
 
 
 bool DiskSystem::IsBlockAllocated(const SIZE_T block)
@@ -536,14 +1254,15 @@ ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innum
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountBits(bitmap,offset,innumblocks)>0) { 
+    for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
+      if (IsBlockAllocated(i)) {
 	cerr << "Disksystem: NotifyAllocateBlocks: Block "<<i<<" is being allocated, but it's already allocated!"<<endl;
       }
     }
-    SETBIT(i);
   }
+  SetBits(bitmap,offset,innumblocks,true);
+  MarkBitMapDirty(offset,innumblocks);
 
   return ERROR_NOERROR;
 }
@@ -556,15 +1275,33 @@ ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset,const SIZE_T innu
   }
 
 
-  for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
-    if (!IsBlockAllocated(i)) {
-      if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+  if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountBits(bitmap,offset,innumblocks)<innumblocks) { 
+    for (SIZE_T i=offset; i<(offset+innumblocks); i++) { 
+      if (!IsBlockAllocated(i)) {
 	cerr << "Disksystem: NotifyDeallocateBlocks: Block "<<i<<" is being deallocated, but it's already deallocated!"<<endl;
       }
     }
-    CLEARBIT(i);
   }
+  SetBits(bitmap,offset,innumblocks,false);
+  MarkBitMapDirty(offset,innumblocks);
+
+  return ERROR_NOERROR;
+}
+
+
+SIZE_T DiskSystem::GetNumAllocatedBlocks() const
+{
+  return CountBits(bitmap,0,numblocks);
+}
+
+ERROR_T DiskSystem::FindFreeBlocks(const SIZE_T innumblocks, SIZE_T &offset, const SIZE_T from) const
+{
+  SIZE_T start = innumblocks==1 ? FindBit(bitmap,numblocks,from,false) : FindClearRun(bitmap,numblocks,innumblocks,from);
 
+  if (start>=numblocks || innumblocks==0) { 
+    return ERROR_NOSPACE;
+  }
+  offset=start;
   return ERROR_NOERROR;
 }
 
@@ -583,15 +1320,27 @@ ostream & DiskSystem::Print(ostream &os) const
      << ", averageseeklatency="<<averageseeklatency
      << ", trackseeklatency="<<trackseeklatency
      << ", rotationallatency="<<rotationallatency
-     << ", bitmap=";
+     << ", backend="<<backend
+     << ", model="<<model;
 
-  for (SIZE_T i=0;i<numblocks;i++) { 
-    if (GETBIT(i)) { 
-      os <<"*";
-    } else {
-      os <<".";
+  for (SIZE_T i=0;i<modelparams.size();i++) { 
+    os << ", "<<modelparams[i].first<<"="<<modelparams[i].second;
+  }
+
+  os << ", bitmap=";
+
+  // a byte of the bitmap at a time
+  string bits(numblocks,'.');
+
+  for (SIZE_T i=0;i<numblocks;i+=8) { 
+    BYTE_T b=bitmap[i/8];
+    for (SIZE_T j=i;b && j<numblocks;b<<=1, j++) { 
+      if (b & 0x80) { 
+	bits[j]='*';
+      }
     }
   }
+  os << bits;
 
   os <<")";
   return os;
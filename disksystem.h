@@ -4,21 +4,71 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <deque>
+#include <utility>
 
 #include "global.h"
+#include "diskqueue.h"
+#include "diskscheduler.h"
 #include "block.h"
 
+class TraceWriter;
+
 using namespace std;
 
 // Models a single disk with a single outstanding request
 //
+// The simulated disk serves one request at a time.  The requests
+// given to Submit together are served in the order its scheduler
+// picks (see DiskScheduler), first come first served by default.
+// With a queue depth above 1 the real reads and writes of the data
+// file can overlap: Submit starts requests and Complete collects them
+// as they finish, through io_uring or a pool of threads (see
+// DiskQueue).
+//
 // Includes storage allocator and free space bitmap to 
 // simplify project - REAL DISKS DO NOT HAVE ALLOCATORS OR BITMAPS
 //
 class DiskSystem {
+  // An array drives its members' models itself
+  friend class ArrayDiskSystem;
  private:
   BYTE_T *bitmap;
-  FILE*  datafilefd;
+  // Blocks are read and written with pread and pwrite, at 64 bit
+  // offsets, so the data file can be far larger than 4 GB
+  int    datafd;
+  // With the mmap backend, the data and bitmap files are mapped
+  // shared, so blocks are copied to and from the page cache directly
+  // and processes using the same disk share its memory.  bitmap then
+  // points into the bitmap file's mapping.  With the ram backend the
+  // blocks are kept in an anonymous mapping and the bitmap in memory,
+  // and neither file is used, so they last only as long as the disk
+  // is open.
+  string backend;
+  BYTE_T *datamap;
+  size_t datamaplen;
+  size_t datamapskip;
+  bool   bitmapmapped;
+  // The bytes of the bitmap changed since it was last written, which
+  // are all WriteBitMap writes
+  SIZE_T bitmapdirtylo;
+  SIZE_T bitmapdirtyhi;
+  // Asynchronous requests go through queue if there is one, and are
+  // otherwise done as they are submitted
+  DiskQueue *queue;
+  // Submitted but not returned by Complete, how many of those the
+  // queue has, and those waiting for room in the queue
+  SIZE_T outstanding;
+  SIZE_T inqueue;
+  deque<DiskRequest *> waiting;
+  vector<DiskRequest *> finished;
+  // Orders the requests of a Submit for the simulated disk
+  DiskScheduler *scheduler;
+  // Simulated time the disk has spent serving requests, the clock
+  // the scheduler works by
+  double disktime;
+  // Records the requests served, if set
+  TraceWriter *trace;
   FILE*  configfilefd;
   FILE*  bitmapfilefd;
 
@@ -42,7 +92,32 @@ class DiskSystem {
   double rotationallatency;
 
  protected:
-  virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
+  // How the simulated device times its requests: "disk", the rotating
+  // disk modelled here, or another model (see FlashDiskSystem) whose
+  // parameters are kept in the config file as name value pairs
+  string model;
+  vector<pair<string, string> > modelparams;
+
+  virtual double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+  // A model parameter, which takes and is recorded with the value def
+  // if the config file doesn't give it
+  double  GetModelParam(const string &name, const double def);
+  // Byte offset of a block in the data file
+  long long DataOffset(const SIZE_T block) const;
+  // Where the block is in the data file's mapping
+  BYTE_T *MappedBlock(const SIZE_T block) const;
+  ERROR_T OpenDataFile(const string &dataname, const bool create);
+  ERROR_T MapDataFile();
+  ERROR_T MapBitMap();
+  ERROR_T AllocateRAM();
+  // Moves data to or from the blocks, the first done bytes excepted
+  ERROR_T Transfer(const bool write, const SIZE_T block, const SIZE_T num,
+		   BYTE_T *data, const size_t done=0);
+  // Finishes what the queue did of a request
+  void    Finish(DiskRequest *req);
+  // Starts as many waiting requests as the queue has room for
+  void    StartWaiting();
+  void    Reap(const SIZE_T min);
 
   ERROR_T SanityCheckConfig();
   ERROR_T InitFromConfigFile();
@@ -51,6 +126,9 @@ class DiskSystem {
   ERROR_T WriteConfig();
   ERROR_T ReadBitMap();
   ERROR_T WriteBitMap();
+  void    MarkBitMapDirty(const SIZE_T first, const SIZE_T num);
+  // Advances the disk's clock over a request, tracing it
+  void    Served(const SIZE_T off, const SIZE_T num, const bool write, const double reqtime);
   
    
  public:
@@ -67,13 +145,19 @@ class DiskSystem {
 	     const SIZE_T tracks=0,
 	     const double avgseek=0,
 	     const double trackseek=0,
-	     const double rotlat=0);
+	     const double rotlat=0,
+	     const string &backend="file");
   DiskSystem() { throw GenericException(); } 
   DiskSystem(const DiskSystem &rhs) { throw GenericException();}
   DiskSystem & operator=(const DiskSystem &rhs) { throw GenericException(); return *this;}
 
   virtual ~DiskSystem();
 
+  // Opens the disk with whichever model its config file names
+  static DiskSystem *Open(const string &filestem);
+  // Models are disk, flash, or array
+  static bool IsValidModel(const string &name);
+
   // Each returns the number of milliseconds the operation has taken
 
   ERROR_T Read(const SIZE_T inoffblock,
@@ -94,8 +178,64 @@ class DiskSystem {
 		const Block &blocks,
 		double &reqtime);
 
+  // Same as above, but to or from numblock*blocksize bytes of
+  // caller supplied memory, avoiding the Block copies
+  ERROR_T Read(const SIZE_T inoffblock,
+	       const SIZE_T numblock,
+	       BYTE_T *data,
+	       double &reqtime);
+
+  ERROR_T Write(const SIZE_T inoffblock,
+		const SIZE_T numblock,
+		const BYTE_T *data,
+		double &reqtime);
+
+  // Asynchronous access.  Submit checks each request, works out its
+  // simulated time as Read or Write would, taking them in the order
+  // the scheduler picks, and starts it, or leaves it for Complete to
+  // start once the queue has room, so that Submit never waits for
+  // the data file.  Complete
+  // waits until at least min requests (or all of them, if fewer are
+  // outstanding) have finished and adds them to done, with their rc
+  // set.  Only one thread may use these at a time, though the
+  // synchronous calls may be used meanwhile on other blocks.
+  ERROR_T Submit(const vector<DiskRequest *> &reqs);
+  void    Complete(vector<DiskRequest *> &done, const SIZE_T min=1);
+  SIZE_T  GetNumOutstanding() const;
+
+  // Lets depth requests be carried out at once, by engine (see
+  // DiskQueue::Create), or one at a time if depth is 1.  Nothing may
+  // be outstanding.
+  ERROR_T SetQueueDepth(const SIZE_T depth, const string &engine="auto");
+  SIZE_T  GetQueueDepth() const;
+  // uring, threads, or sync
+  string  GetQueueEngine() const;
+
+  // Records each request served to trace, or stops if it is 0.  The
+  // trace must outlive its use here.
+  void    SetTrace(TraceWriter *trace);
+
+  // Picks the scheduler by name (see DiskScheduler::Create), which
+  // starts its statistics afresh
+  ERROR_T SetScheduler(const string &name);
+  const DiskScheduler *GetScheduler() const;
+
+  // Makes the data and bitmap written so far durable.  Only does
+  // anything with the mmap backend, which otherwise leaves it to
+  // the kernel when to write the mappings back.
+  ERROR_T Sync();
+
+  // "file" for pread and pwrite, "mmap", or "ram"
+  const string &GetBackend() const;
+  const string &GetModel() const;
+  // Whatever the model counts beyond the requests' times
+  virtual ostream & PrintModelStats(ostream &os) const;
+
   SIZE_T GetBlockSize() const;
   SIZE_T GetNumBlocks() const;
+  // The last block the previous request touched, which is where
+  // the next request starts seeking from
+  virtual SIZE_T GetHeadBlock() const;
 
   //
   // These are notification functions that should be called when
@@ -108,6 +248,12 @@ class DiskSystem {
 				 const SIZE_T innumblocks);
 
   bool    IsBlockAllocated(const SIZE_T offset);
+  SIZE_T  GetNumAllocatedBlocks() const;
+  // Where the first run of innumblocks unallocated blocks at or after
+  // from starts, for allocators to build on; ERROR_NOSPACE if none
+  ERROR_T FindFreeBlocks(const SIZE_T innumblocks,
+			 SIZE_T &offset,
+			 const SIZE_T from=0) const;
 
 
   ostream & Print(ostream &os) const;
@@ -115,4 +261,23 @@ class DiskSystem {
 
 inline ostream & operator<< (ostream &os, const DiskSystem &rhs) { return rhs.Print(os);}
 
+
+//
+// Holds the disk DiskSystem::Open makes for as long as a program
+// needs it, and can be used where a DiskSystem * is wanted
+//
+class OpenDisk {
+ private:
+  DiskSystem *disk;
+ public:
+  OpenDisk(const string &filestem) : disk(DiskSystem::Open(filestem)) {}
+  OpenDisk(const OpenDisk &rhs) { throw GenericException();}
+  OpenDisk & operator=(const OpenDisk &rhs) { throw GenericException(); return *this;}
+  ~OpenDisk() { delete disk; }
+
+  DiskSystem & operator*() const { return *disk; }
+  DiskSystem * operator->() const { return disk; }
+  operator DiskSystem *() const { return disk; }
+};
+
 #endif
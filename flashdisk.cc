@@ -0,0 +1,349 @@
+#include <math.h>
+#include <stdio.h>
+
+#include "flashdisk.h"
+
+const SIZE_T FlashDiskSystem::NOPAGE=(SIZE_T)-1;
+const SIZE_T FlashDiskSystem::MINFREEBLOCKS=2;
+
+
+FlashDiskSystem::FlashDiskSystem(const string &filestem) :
+  DiskSystem(filestem), ftlname(filestem+".ftl"),
+  pagesread(0), pageswritten(0), pagescopied(0), erases(0)
+{
+  StartFTL(true);
+}
+
+FlashDiskSystem::FlashDiskSystem(const string &filestem,
+				 const SIZE_T blocks,
+				 const SIZE_T blocksize,
+				 const SIZE_T heads,
+				 const SIZE_T blockspertrack,
+				 const SIZE_T tracks,
+				 const double avgseek,
+				 const double trackseek,
+				 const double rotlat,
+				 const string &backend,
+				 const vector<pair<string, string> > &params) :
+  DiskSystem(filestem,true,0,blocks,blocksize,heads,blockspertrack,tracks,avgseek,trackseek,rotlat,backend),
+  ftlname(filestem+".ftl"), pagesread(0), pageswritten(0), pagescopied(0), erases(0)
+{
+  for (SIZE_T i=0;i<params.size();i++) {
+    if (!IsValidParam(params[i].first)) {
+      cerr << "Unknown flash parameter "<<params[i].first<<".\n";
+      throw GenericException();
+    }
+  }
+  model="flash";
+  modelparams=params;
+  // whatever FTL file a disk of the same name left is stale
+  StartFTL(false);
+  // with the defaults filled in
+  WriteConfig();
+}
+
+FlashDiskSystem::~FlashDiskSystem()
+{
+  WriteFTL();
+}
+
+
+bool FlashDiskSystem::IsValidParam(const string &name)
+{
+  return name=="channels" || name=="diesperchannel" || name=="pagesperblock" ||
+    name=="readlatency" || name=="programlatency" || name=="eraselatency" ||
+    name=="transferlatency" || name=="overprovision";
+}
+
+void FlashDiskSystem::PrintParams(ostream &os)
+{
+  os << "channels, diesperchannel, pagesperblock, readlatency, programlatency,\n"
+     << "eraselatency, transferlatency (all ms, transfer per page), or overprovision";
+}
+
+
+void FlashDiskSystem::StartFTL(const bool load)
+{
+  // Defaults are for a current TLC device with 4 KB pages
+  channels=(SIZE_T)GetModelParam("channels",8);
+  diesperchannel=(SIZE_T)GetModelParam("diesperchannel",4);
+  pagesperblock=(SIZE_T)GetModelParam("pagesperblock",256);
+  readlatency=GetModelParam("readlatency",0.05);
+  programlatency=GetModelParam("programlatency",0.5);
+  eraselatency=GetModelParam("eraselatency",3);
+  transferlatency=GetModelParam("transferlatency",0.01);
+  overprovision=GetModelParam("overprovision",0.07);
+
+  if (channels<1 || diesperchannel<1 || pagesperblock<1 ||
+      readlatency<0 || programlatency<0 || eraselatency<0 || transferlatency<0 ||
+      overprovision<0) {
+    cerr << "Impossible flash parameters.\n";
+    throw GenericException();
+  }
+
+  numdies=channels*diesperchannel;
+
+  SIZE_T perdie=(GetNumBlocks()+numdies-1)/numdies;
+  SIZE_T needed=(perdie+pagesperblock-1)/pagesperblock;
+
+  // Garbage collection must always find an erase block with a page to
+  // reclaim, so there are at least a few more than the data needs
+  blocksperdie=(SIZE_T)ceil(perdie*(1+overprovision)/pagesperblock);
+  if (blocksperdie<needed+MINFREEBLOCKS+1) {
+    blocksperdie=needed+MINFREEBLOCKS+1;
+  }
+
+  where.assign(GetNumBlocks(),NOPAGE);
+  holds.assign(numdies*blocksperdie*pagesperblock,NOPAGE);
+  validpages.assign(numdies*blocksperdie,0);
+  erased.assign(numdies*blocksperdie,true);
+  openblock.assign(numdies,0);
+  nextpage.assign(numdies,pagesperblock);
+  freeblocks.assign(numdies,deque<SIZE_T>());
+
+  if (load && ReadFTL()) {
+    return;
+  }
+
+  for (SIZE_T d=0;d<numdies;d++) {
+    for (SIZE_T e=0;e<blocksperdie;e++) {
+      freeblocks[d].push_back(d*blocksperdie+e);
+    }
+  }
+
+  for (SIZE_T b=0;b<GetNumBlocks();b++) {
+    Place(b%numdies,b);
+  }
+}
+
+
+//
+// The FTL file is a row of SIZE_Ts: the number of blocks, dies, erase
+// blocks per die, and pages per erase block; where each block is;
+// each die's open erase block and next page in it; and each die's
+// count of erased blocks followed by them, in order.  The rest of the
+// FTL follows from those.
+//
+void FlashDiskSystem::WriteFTL() const
+{
+  vector<SIZE_T> state;
+
+  state.push_back(GetNumBlocks());
+  state.push_back(numdies);
+  state.push_back(blocksperdie);
+  state.push_back(pagesperblock);
+  state.insert(state.end(),where.begin(),where.end());
+  state.insert(state.end(),openblock.begin(),openblock.end());
+  state.insert(state.end(),nextpage.begin(),nextpage.end());
+  for (SIZE_T d=0;d<numdies;d++) {
+    state.push_back(freeblocks[d].size());
+    state.insert(state.end(),freeblocks[d].begin(),freeblocks[d].end());
+  }
+
+  FILE *f=fopen(ftlname.c_str(),"w");
+
+  if (!f || fwrite(&state[0],sizeof(SIZE_T),state.size(),f)!=state.size()) {
+    cerr << "Can't write the FTL to "<<ftlname<<".\n";
+  }
+  if (f) {
+    fclose(f);
+  }
+}
+
+bool FlashDiskSystem::ReadFTL()
+{
+  FILE *f=fopen(ftlname.c_str(),"r");
+
+  if (!f) {
+    return false;
+  }
+
+  vector<SIZE_T> state;
+  SIZE_T buf[4096];
+  size_t n;
+
+  while ((n=fread(buf,sizeof(SIZE_T),4096,f))>0) {
+    state.insert(state.end(),buf,buf+n);
+  }
+  fclose(f);
+
+  SIZE_T numblocks=GetNumBlocks();
+  SIZE_T numerase=numdies*blocksperdie;
+  SIZE_T numpages=numerase*pagesperblock;
+  SIZE_T pos=4+numblocks+2*numdies;
+
+  if (state.size()<pos ||
+      state[0]!=numblocks || state[1]!=numdies || state[2]!=blocksperdie || state[3]!=pagesperblock) {
+    return false;
+  }
+
+  // Check it all before changing anything
+  vector<SIZE_T> h(numpages,NOPAGE);
+  vector<bool>   e(numerase,false);
+
+  for (SIZE_T b=0;b<numblocks;b++) {
+    SIZE_T p=state[4+b];
+    if (p!=NOPAGE && (p>=numpages || h[p]!=NOPAGE || (p/pagesperblock)/blocksperdie!=b%numdies)) {
+      return false;
+    }
+    if (p!=NOPAGE) {
+      h[p]=b;
+    }
+  }
+  for (SIZE_T d=0;d<numdies;d++) {
+    if (pos>=state.size() || state[pos]>blocksperdie || state.size()-pos-1<state[pos]) {
+      return false;
+    }
+    for (SIZE_T i=pos+1;i<=pos+state[pos];i++) {
+      if (state[i]/blocksperdie!=d || e[state[i]]) {
+	return false;
+      }
+      e[state[i]]=true;
+    }
+    pos+=1+state[pos];
+  }
+  if (pos!=state.size()) {
+    return false;
+  }
+  for (SIZE_T d=0;d<numdies;d++) {
+    SIZE_T open=state[4+numblocks+d];
+    SIZE_T next=state[4+numblocks+numdies+d];
+    // a die that has never filled a page has no open block yet
+    if (next>pagesperblock ||
+	(next<pagesperblock && (open>=numerase || open/blocksperdie!=d || e[open]))) {
+      return false;
+    }
+  }
+
+  where.assign(state.begin()+4,state.begin()+4+numblocks);
+  holds=h;
+  erased=e;
+  validpages.assign(numerase,0);
+  for (SIZE_T b=0;b<numblocks;b++) {
+    if (where[b]!=NOPAGE) {
+      validpages[where[b]/pagesperblock]++;
+    }
+  }
+  openblock.assign(state.begin()+4+numblocks,state.begin()+4+numblocks+numdies);
+  nextpage.assign(state.begin()+4+numblocks+numdies,state.begin()+4+numblocks+2*numdies);
+  pos=4+numblocks+2*numdies;
+  for (SIZE_T d=0;d<numdies;d++) {
+    freeblocks[d].assign(state.begin()+pos+1,state.begin()+pos+1+state[pos]);
+    pos+=1+state[pos];
+  }
+  return true;
+}
+
+
+void FlashDiskSystem::Place(const SIZE_T die, const SIZE_T block)
+{
+  if (nextpage[die]==pagesperblock) {
+    openblock[die]=freeblocks[die].front();
+    freeblocks[die].pop_front();
+    erased[openblock[die]]=false;
+    nextpage[die]=0;
+  }
+
+  SIZE_T page=openblock[die]*pagesperblock+nextpage[die]++;
+  SIZE_T old=where[block];
+
+  if (old!=NOPAGE) {
+    holds[old]=NOPAGE;
+    validpages[old/pagesperblock]--;
+  }
+  where[block]=page;
+  holds[page]=block;
+  validpages[openblock[die]]++;
+}
+
+
+bool FlashDiskSystem::Collect(const SIZE_T die, double &dietime)
+{
+  SIZE_T victim=NOPAGE;
+
+  // Greedy: the erase block with the fewest valid pages, which may be
+  // the open one if it is full
+  for (SIZE_T e=die*blocksperdie;e<(die+1)*blocksperdie;e++) {
+    if (erased[e] || (e==openblock[die] && nextpage[die]<pagesperblock)) {
+      continue;
+    }
+    if (victim==NOPAGE || validpages[e]<validpages[victim]) {
+      victim=e;
+    }
+  }
+  if (victim==NOPAGE || validpages[victim]==pagesperblock) {
+    return false;
+  }
+
+  // The valid pages are copied within the die, without crossing the
+  // channel
+  for (SIZE_T p=victim*pagesperblock;p<(victim+1)*pagesperblock;p++) {
+    if (holds[p]!=NOPAGE) {
+      Place(die,holds[p]);
+      dietime+=readlatency+programlatency;
+      pagescopied++;
+    }
+  }
+
+  dietime+=eraselatency;
+  erases++;
+  erased[victim]=true;
+  freeblocks[die].push_back(victim);
+  return true;
+}
+
+
+double FlashDiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write)
+{
+  // When each die and channel is done with this request's pages so
+  // far, from its start
+  vector<double> die(numdies,0);
+  vector<double> channel(channels,0);
+  double reqtime=0;
+
+  for (SIZE_T b=offblock;b<offblock+numblock;b++) {
+    SIZE_T d=b%numdies;
+    // neighbouring dies are on different channels
+    SIZE_T c=d%channels;
+
+    if (write) {
+      if (nextpage[d]==pagesperblock) {
+	while (freeblocks[d].size()<=MINFREEBLOCKS && Collect(d,die[d])) {
+	}
+      }
+      // the page crosses the channel into the die's register, and is
+      // then programmed
+      channel[c]=(channel[c]>die[d] ? channel[c] : die[d])+transferlatency;
+      die[d]=channel[c]+programlatency;
+      Place(d,b);
+      pageswritten++;
+    } else {
+      die[d]+=readlatency;
+      channel[c]=(channel[c]>die[d] ? channel[c] : die[d])+transferlatency;
+      die[d]=channel[c];
+      pagesread++;
+    }
+    if (die[d]>reqtime) {
+      reqtime=die[d];
+    }
+  }
+
+  return reqtime;
+}
+
+
+double FlashDiskSystem::GetWriteAmplification() const
+{
+  return pageswritten>0 ? (pageswritten+pagescopied)/pageswritten : 0;
+}
+
+ostream & FlashDiskSystem::PrintModelStats(ostream &os) const
+{
+  os << "model           = flash"<<endl;
+  os << "flashreads      = "<<pagesread<<endl;
+  os << "flashwrites     = "<<pageswritten<<endl;
+  os << "flashgccopies   = "<<pagescopied<<endl;
+  os << "flasherases     = "<<erases<<endl;
+  os << "flashwriteamp   = "<<GetWriteAmplification()<<endl;
+  return os;
+}
@@ -0,0 +1,120 @@
+#ifndef _flashdisk
+#define _flashdisk
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <utility>
+
+#include "global.h"
+#include "disksystem.h"
+
+using namespace std;
+
+//
+// A disk whose simulated times are those of a flash device rather
+// than a rotating disk.  The blocks of the disk are the device's
+// pages, which are read and programmed a page at a time but erased
+// pagesperblock at a time, so a page can't be overwritten in place.
+// A page level flash translation layer (FTL) instead writes each
+// block to the next free page and remembers where it went, and
+// garbage collection makes room by copying the still valid pages out
+// of the erase block with the fewest and erasing it.  The copies are
+// the device's write amplification, which is counted.
+//
+// The device has channels, each with diesperchannel dies.  Blocks are
+// spread over the dies in turn (block b lives on die b mod the number
+// of dies), and the pages of a request on different dies are read or
+// programmed at the same time, though each page still crosses its
+// channel one at a time.  Garbage collection on a die holds up the
+// write that needed the room.
+//
+// The seek parameters of the disk are ignored.  The FTL is kept in
+// filestem.ftl, written when the disk is closed, so that garbage
+// collection picks up where the last run left it.  A new disk, or one
+// whose FTL file is missing or doesn't match its geometry, starts as
+// if every block had been written once, in order, with the
+// overprovisioned space free.  The FTL is kept with the ram backend
+// too, as the config is, which is what an array's flash members use.
+//
+class FlashDiskSystem : public DiskSystem {
+ private:
+  static const SIZE_T NOPAGE;
+  // Collect garbage on a die once it is down to this many free erase
+  // blocks
+  static const SIZE_T MINFREEBLOCKS;
+
+  SIZE_T channels;
+  SIZE_T diesperchannel;
+  SIZE_T pagesperblock;
+  // Milliseconds
+  double readlatency;
+  double programlatency;
+  double eraselatency;
+  double transferlatency;
+  // Spare space, as a fraction of the disk's size
+  double overprovision;
+
+  SIZE_T numdies;
+  SIZE_T blocksperdie;
+  // The FTL.  Physical pages are numbered by die, then erase block
+  // within the die, then page within the erase block.
+  vector<SIZE_T> where;                 // block -> physical page
+  vector<SIZE_T> holds;                 // physical page -> block, or NOPAGE
+  vector<SIZE_T> validpages;            // per erase block
+  vector<SIZE_T> openblock;             // per die, the block being filled
+  vector<SIZE_T> nextpage;              // and its next free page
+  vector<deque<SIZE_T> > freeblocks;    // per die, erased blocks
+  vector<bool>   erased;                // per erase block
+  string ftlname;
+
+  // Counted since the disk was opened
+  double pagesread;
+  double pageswritten;
+  double pagescopied;
+  double erases;
+
+  // Sets up the FTL, from the FTL file if load and it has one
+  void   StartFTL(const bool load);
+  // returns false, leaving the FTL alone, if the file is missing or
+  // doesn't fit this disk
+  bool   ReadFTL();
+  void   WriteFTL() const;
+  void   Place(const SIZE_T die, const SIZE_T block);
+  // Frees an erase block on the die, adding the time it takes to
+  // dietime.  returns false if none has a page to reclaim
+  bool   Collect(const SIZE_T die, double &dietime);
+ protected:
+  double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+ public:
+  // Opens an existing disk
+  FlashDiskSystem(const string &filestem);
+  // Makes one, as DiskSystem does, with the model parameters given
+  // (see IsValidParam), and the defaults for the rest
+  FlashDiskSystem(const string &filestem,
+		  const SIZE_T blocks,
+		  const SIZE_T blocksize,
+		  const SIZE_T heads,
+		  const SIZE_T blockspertrack,
+		  const SIZE_T tracks,
+		  const double avgseek,
+		  const double trackseek,
+		  const double rotlat,
+		  const string &backend,
+		  const vector<pair<string, string> > &params);
+  // Saves the FTL
+  ~FlashDiskSystem();
+
+  // Pages programmed, garbage collection's copies included, per page
+  // written
+  double GetWriteAmplification() const;
+  ostream & PrintModelStats(ostream &os) const;
+
+  // channels, diesperchannel, pagesperblock, readlatency,
+  // programlatency, eraselatency, transferlatency, or overprovision
+  static bool IsValidParam(const string &name);
+  static void PrintParams(ostream &os);
+};
+
+#endif
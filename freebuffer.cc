@@ -6,7 +6,8 @@
 
 void usage() 
 {
-  cerr << "usage: freebuffer cachesize filestem blocknum numblocks\n";
+  cerr << "usage: freebuffer cachesize filestem blocknum numblocks [name=value ...]\n";
+  BufferCacheConfig::PrintUsage(cerr);
 }
 
 int main(int argc, char *argv[])
@@ -18,9 +19,17 @@ int main(int argc, char *argv[])
   SIZE_T cachesize=atoi(argv[2]);
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
+  BufferCacheConfig config;
 
-  DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  for (int i=5;i<argc;i++) {
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      exit(-1);
+    }
+  }
+
+  OpenDisk disk(argv[1]);
+  BufferCache cache(disk,cachesize,config);
 
   cache.Attach();
 
@@ -18,9 +18,9 @@ int main(int argc, char *argv[])
   }
 #endif
 
-  DiskSystem disk(argv[1]);
+  OpenDisk disk(argv[1]);
   
-  cerr << "Disk is as follows.\n" << disk << "\n";
+  cerr << "Disk is as follows.\n" << *disk << "\n";
 
   cerr << "Done.\n";
 
@@ -1,12 +1,22 @@
 #include <string>
 #include <stdlib.h>
+#include <string.h>
 
 #include "disksystem.h"
+#include "flashdisk.h"
+#include "arraydisk.h"
 
 
 void usage() 
 {
-  cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat\n";
+  cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat [backend] [model=M] [param=value]*\n";
+  cerr << "backend is file (the default), mmap, or ram\n";
+  cerr << "model is disk (the default) or flash, whose params are\n";
+  FlashDiskSystem::PrintParams(cerr);
+  cerr << "\n";
+  cerr << "any of the array params makes an array of disks of that model\n";
+  ArrayDiskSystem::PrintParams(cerr);
+  cerr << "\n";
 }
 
 int main(int argc, char *argv[])
@@ -16,20 +26,92 @@ int main(int argc, char *argv[])
     exit(-1);
   }
 
-  DiskSystem disk(argv[1],
-		  true,
-		  0,
-		  atoi(argv[2]),
-		  atoi(argv[3]),
-		  atoi(argv[4]),
-		  atoi(argv[5]),
-		  atoi(argv[6]),
-		  atof(argv[7]),
-		  atof(argv[8]),
-		  atof(argv[9]));
+  string backend="file";
+  string model="disk";
+  vector<pair<string, string> > params;
+  vector<pair<string, string> > arrayparams;
+
+  for (int i=10;i<argc;i++) { 
+    char *eq=strchr(argv[i],'=');
+    if (!eq) { 
+      if (i>10) { 
+	usage();
+	exit(-1);
+      }
+      backend=argv[i];
+      continue;
+    }
+    string name(argv[i],eq-argv[i]);
+    if (name=="model") { 
+      model=eq+1;
+    } else if (FlashDiskSystem::IsValidParam(name)) { 
+      params.push_back(pair<string, string>(name,eq+1));
+    } else if (ArrayDiskSystem::IsValidParam(name)) { 
+      arrayparams.push_back(pair<string, string>(name,eq+1));
+    } else {
+      usage();
+      exit(-1);
+    }
+  }
+
+  if (model=="array") { 
+    model="disk";
+    if (arrayparams.empty()) { 
+      arrayparams.push_back(pair<string, string>("disks","2"));
+    }
+  }
+  if (!DiskSystem::IsValidModel(model) || (model!="flash" && !params.empty())) { 
+    usage();
+    exit(-1);
+  }
+
+  DiskSystem *disk;
+
+  if (!arrayparams.empty()) { 
+    disk = new ArrayDiskSystem(argv[1],
+			       atoi(argv[2]),
+			       atoi(argv[3]),
+			       atoi(argv[4]),
+			       atoi(argv[5]),
+			       atoi(argv[6]),
+			       atof(argv[7]),
+			       atof(argv[8]),
+			       atof(argv[9]),
+			       backend,
+			       arrayparams,
+			       model,
+			       params);
+  } else if (model=="flash") { 
+    disk = new FlashDiskSystem(argv[1],
+			       atoi(argv[2]),
+			       atoi(argv[3]),
+			       atoi(argv[4]),
+			       atoi(argv[5]),
+			       atoi(argv[6]),
+			       atof(argv[7]),
+			       atof(argv[8]),
+			       atof(argv[9]),
+			       backend,
+			       params);
+  } else {
+    disk = new DiskSystem(argv[1],
+			  true,
+			  0,
+			  atoi(argv[2]),
+			  atoi(argv[3]),
+			  atoi(argv[4]),
+			  atoi(argv[5]),
+			  atoi(argv[6]),
+			  atof(argv[7]),
+			  atof(argv[8]),
+			  atof(argv[9]),
+			  backend);
+  }
   
   
-  cerr << "Disk is as follows.\n" << disk << "\n";
+  cerr << "Disk is as follows.\n" << *disk << "\n";
+
+  delete disk;
 
   cerr << "Done.\n";
 
@@ -0,0 +1,146 @@
+#include <algorithm>
+
+#include <math.h>
+
+#include "mrc.h"
+
+
+MissRatioCurve::MissRatioCurve(const double r) : rate(r), accesses(0), samples(0), coldmisses(0), marked(1024,0), now(0)
+{
+  if (!(rate>0 && rate<=1)) {
+    throw GenericException();
+  }
+  threshold=(SIZE_T)(rate*(1<<HASHBITS));
+  if (threshold<1) {
+    threshold=1;
+  }
+  pthread_mutex_init(&lock,0);
+}
+
+MissRatioCurve::~MissRatioCurve()
+{
+  pthread_mutex_destroy(&lock);
+}
+
+bool MissRatioCurve::IsSampled(const SIZE_T blocknum) const
+{
+  // Fibonacci hashing spreads neighbouring blocks over the range
+  unsigned long long h=(unsigned long long)blocknum*0x9E3779B97F4A7C15ULL;
+
+  return (SIZE_T)(h>>(64-HASHBITS))<threshold;
+}
+
+void MissRatioCurve::Mark(const SIZE_T time, const int delta)
+{
+  for (SIZE_T i=time;i<marked.size();i+=i&(-i)) {
+    marked[i]+=delta;
+  }
+}
+
+SIZE_T MissRatioCurve::CountMarked(const SIZE_T time) const
+{
+  SIZE_T n=0;
+
+  for (SIZE_T i=time;i>0;i-=i&(-i)) {
+    n+=marked[i];
+  }
+  return n;
+}
+
+void MissRatioCurve::Renumber()
+{
+  // Only the most recent access to each block matters, so those are
+  // numbered again from 1 in the same order, leaving as much room
+  // again for new accesses
+  vector<pair<SIZE_T, SIZE_T> > order;
+
+  for (map<SIZE_T, SIZE_T>::const_iterator i=lastaccess.begin();i!=lastaccess.end();++i) {
+    order.push_back(pair<SIZE_T, SIZE_T>(i->second,i->first));
+  }
+  sort(order.begin(),order.end());
+
+  marked.assign(2*order.size()+1024,0);
+  for (SIZE_T i=0;i<order.size();i++) {
+    lastaccess[order[i].second]=i+1;
+    Mark(i+1,1);
+  }
+  now=order.size();
+}
+
+void MissRatioCurve::Access(const SIZE_T blocknum, const bool fetch)
+{
+  if (fetch) {
+    __atomic_fetch_add(&accesses,1,__ATOMIC_RELAXED);
+  }
+
+  if (!IsSampled(blocknum)) {
+    return;
+  }
+
+  pthread_mutex_lock(&lock);
+
+  if (now+1>=marked.size()) {
+    Renumber();
+  }
+  now++;
+  if (fetch) {
+    samples++;
+  }
+
+  map<SIZE_T, SIZE_T>::iterator i=lastaccess.find(blocknum);
+
+  if (i==lastaccess.end()) {
+    if (fetch) {
+      coldmisses++;
+    }
+    lastaccess[blocknum]=now;
+  } else {
+    SIZE_T distance=CountMarked(now-1)-CountMarked(i->second);
+    if (fetch) {
+      if (distance>=histogram.size()) {
+	histogram.resize(distance+1,0);
+      }
+      histogram[distance]++;
+    }
+    Mark(i->second,-1);
+    i->second=now;
+  }
+  Mark(now,1);
+
+  pthread_mutex_unlock(&lock);
+}
+
+SIZE_T MissRatioCurve::GetNumBlocks() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=lastaccess.size();
+  pthread_mutex_unlock(&lock);
+  return (SIZE_T)(n/rate);
+}
+
+double MissRatioCurve::MissRatio(const SIZE_T cachesize) const
+{
+  pthread_mutex_lock(&lock);
+
+  // A sampled access hits if fewer than cachesize*rate other
+  // sampled blocks were used since the last access to its block
+  SIZE_T limit=(SIZE_T)ceil(cachesize*rate);
+  double misses=coldmisses;
+
+  for (SIZE_T d=limit;d<histogram.size();d++) {
+    misses+=histogram[d];
+  }
+
+  // The sampled blocks may get more or less than their share of the
+  // accesses.  As in SHARDS-adj, the difference is made up (or taken
+  // out) with accesses that hit at any size.
+  double expected=rate*GetNumAccesses();
+  double total = expected>0 ? expected : samples;
+
+  pthread_mutex_unlock(&lock);
+
+  if (total==0) {
+    return 0;
+  }
+  return misses<total ? misses/total : 1;
+}
@@ -0,0 +1,70 @@
+#ifndef _mrc
+#define _mrc
+
+#include <iostream>
+#include <vector>
+#include <map>
+
+#include <pthread.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Estimates the miss ratio an LRU cache of any size would have on
+// an access stream, in one pass over it, by spatial sampling as in
+// SHARDS (Waldspurger et al., FAST 15).  A block is sampled if a hash
+// of its number falls in the first rate of the hash range, so every
+// access to a sampled block is seen and none to the others.  Each
+// sampled access has a reuse distance, the number of other sampled
+// blocks used since the block was last used, and divided by the rate
+// that estimates its LRU stack distance in the whole stream.
+//
+// Accesses that overwrite a block don't need it read on a miss, so
+// they only count as uses of the block and not toward the ratio.
+//
+// Distances are found with a Fenwick tree over the sampled accesses
+// that marks the most recent access to each block, which is
+// renumbered when it fills up.  Only sampled accesses take the lock,
+// so Access can be called from several threads cheaply.
+//
+class MissRatioCurve {
+ private:
+  static const SIZE_T HASHBITS = 24;
+
+  double rate;
+  SIZE_T threshold;
+  SIZE_T accesses;
+  mutable pthread_mutex_t lock;
+  // Protected by lock
+  SIZE_T samples;
+  SIZE_T coldmisses;
+  map<SIZE_T, SIZE_T> lastaccess;   // sampled block to time of its last access
+  vector<SIZE_T> marked;            // Fenwick tree over times 1..marked.size()-1
+  SIZE_T now;
+  vector<SIZE_T> histogram;         // sampled reuse distance to count
+
+  void   Mark(const SIZE_T time, const int delta);
+  SIZE_T CountMarked(const SIZE_T time) const;
+  void   Renumber();
+ public:
+  // rate is the fraction of blocks sampled, above 0 and at most 1
+  MissRatioCurve(const double rate);
+  ~MissRatioCurve();
+
+  bool   IsSampled(const SIZE_T blocknum) const;
+  // fetch is false if the access would not read the block on a miss
+  void   Access(const SIZE_T blocknum, const bool fetch=true);
+
+  double GetRate() const { return rate; }
+  // Accesses that fetch the block
+  SIZE_T GetNumAccesses() const { return __atomic_load_n(&accesses,__ATOMIC_RELAXED); }
+  // Estimated number of distinct blocks used
+  SIZE_T GetNumBlocks() const;
+  // Estimated fraction of fetching accesses that miss in an LRU
+  // cache of cachesize blocks, counting a first use as a miss
+  double MissRatio(const SIZE_T cachesize) const;
+};
+
+#endif
@@ -6,7 +6,8 @@
 
 void usage() 
 {
-  cerr << "usage: readbuffer cachesize filestem blocknum numblocks > data\n";
+  cerr << "usage: readbuffer cachesize filestem blocknum numblocks [name=value ...] > data\n";
+  BufferCacheConfig::PrintUsage(cerr);
 }
 
 int main(int argc, char *argv[])
@@ -18,24 +19,39 @@ int main(int argc, char *argv[])
   SIZE_T cachesize=atoi(argv[1]);
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
+  BufferCacheConfig config;
 
-  DiskSystem disk(argv[2]);
-  BufferCache cache(&disk,cachesize);
+  for (int i=5;i<argc;i++) {
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      exit(-1);
+    }
+  }
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  OpenDisk disk(argv[2]);
+  BufferCache cache(disk,cachesize,config);
 
   cache.Attach();
 
-  for (unsigned i=blocknum;i<(blocknum+numblocks);i++) { 
-    Block block(blocksize);
+  // read a cache full at a time so the misses are read together
+  SIZE_T batch = cachesize>0 ? cachesize : 1;
+
+  for (unsigned i=blocknum;i<(blocknum+numblocks);i+=batch) { 
+    vector<SIZE_T> blocknums;
+    vector<Block> blocks;
     ERROR_T rc;
-    rc=cache.ReadBlock(i,block);
+    for (unsigned k=i;k<(blocknum+numblocks) && k<i+batch;k++) {
+      blocknums.push_back(k);
+    }
+    rc=cache.ReadBlocks(blocknums,blocks);
     if (rc!=ERROR_NOERROR) { 
-      cerr << "Error " << rc <<" occured when reading block "<< i << endl;
+      cerr << "Error " << rc <<" occured when reading blocks "<< i << " to " << blocknums.back() << endl;
       return -1;
     }
-    for (SIZE_T j=0;j<block.length;j++) { 
-      cout << block.data[j];
+    for (SIZE_T b=0;b<blocks.size();b++) {
+      for (SIZE_T j=0;j<blocks[b].length;j++) { 
+	cout << blocks[b].data[j];
+      }
     }
   }
 
@@ -49,6 +65,9 @@ int main(int argc, char *argv[])
   cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
   cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
   cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "numreadaheads   = "<<cache.GetNumReadAheads()<<endl;
+  cerr << "numreadaheadhits= "<<cache.GetNumReadAheadHits()<<endl;
+  cerr << "numreadaheadwaste= "<<cache.GetNumReadAheadWasted()<<endl;
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
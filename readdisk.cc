@@ -19,11 +19,11 @@ int main(int argc, char *argv[])
   SIZE_T numblocks=atoi(argv[3]);
   double reqtime;
 
-  DiskSystem disk(argv[1]);
+  OpenDisk disk(argv[1]);
 
   vector<Block> b;
 
-  ERROR_T rc= disk.Read(blocknum, numblocks, b, reqtime);
+  ERROR_T rc= disk->Read(blocknum, numblocks, b, reqtime);
 
   if (rc!=ERROR_NOERROR) { 
     cerr << "Error "<< rc << " occured.\n";
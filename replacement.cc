@@ -0,0 +1,713 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replacement.h"
+
+const SIZE_T ReplacementPolicy::NOFRAME;
+
+static const SIZE_T NOFRAME=ReplacementPolicy::NOFRAME;
+
+
+FrameList::FrameList(const SIZE_T numframes) : head(NOFRAME), tail(NOFRAME), size(0)
+{
+  Resize(numframes);
+}
+
+void FrameList::Resize(const SIZE_T numframes)
+{
+  prev.assign(numframes,NOFRAME);
+  next.assign(numframes,NOFRAME);
+  head=tail=NOFRAME;
+  size=0;
+}
+
+void FrameList::PushFront(const SIZE_T f)
+{
+  prev[f]=NOFRAME;
+  next[f]=head;
+  if (head!=NOFRAME) {
+    prev[head]=f;
+  } else {
+    tail=f;
+  }
+  head=f;
+  size++;
+}
+
+void FrameList::Unlink(const SIZE_T f)
+{
+  if (prev[f]!=NOFRAME) {
+    next[prev[f]]=next[f];
+  } else {
+    head=next[f];
+  }
+  if (next[f]!=NOFRAME) {
+    prev[next[f]]=prev[f];
+  } else {
+    tail=prev[f];
+  }
+  prev[f]=next[f]=NOFRAME;
+  size--;
+}
+
+SIZE_T FrameList::FindVictim(const EvictionFilter &filter) const
+{
+  // Unevictable (pinned) frames are skipped, but there are only ever a few
+  SIZE_T f=tail;
+
+  while (f!=NOFRAME && !filter.CanEvict(f)) {
+    f=prev[f];
+  }
+  return f;
+}
+
+void FrameList::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  for (SIZE_T f=tail; f!=NOFRAME && frames.size()<max; f=prev[f]) {
+    if (filter.CanEvict(f)) {
+      frames.push_back(f);
+    }
+  }
+}
+
+
+void GhostList::PushFront(const SIZE_T blocknum)
+{
+  Erase(blocknum);
+  blocks.push_front(blocknum);
+  where[blocknum]=blocks.begin();
+}
+
+void GhostList::Erase(const SIZE_T blocknum)
+{
+  map<SIZE_T, list<SIZE_T>::iterator>::iterator i=where.find(blocknum);
+
+  if (i!=where.end()) {
+    blocks.erase((*i).second);
+    where.erase(i);
+  }
+}
+
+void GhostList::PopBack()
+{
+  if (!blocks.empty()) {
+    where.erase(blocks.back());
+    blocks.pop_back();
+  }
+}
+
+void GhostList::Clear()
+{
+  blocks.clear();
+  where.clear();
+}
+
+
+
+LRUPolicy::LRUPolicy(const SIZE_T numframes) : lru(numframes)
+{}
+
+void LRUPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  lru.PushFront(f);
+}
+
+void LRUPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  lru.Unlink(f);
+  lru.PushFront(f);
+}
+
+void LRUPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  lru.Unlink(f);
+}
+
+SIZE_T LRUPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  return Peek(blocknum,filter);
+}
+
+SIZE_T LRUPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  return lru.FindVictim(filter);
+}
+
+void LRUPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  lru.Coldest(max,filter,frames);
+}
+
+
+
+ClockPolicy::ClockPolicy(const SIZE_T numframes) :
+  referenced(numframes,0), resident(numframes,0), hand(0)
+{}
+
+void ClockPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  resident[f]=1;
+  referenced[f]=1;
+}
+
+void ClockPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  referenced[f]=1;
+}
+
+void ClockPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  resident[f]=0;
+  referenced[f]=0;
+}
+
+SIZE_T ClockPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  SIZE_T n=resident.size();
+
+  // Two sweeps are enough to clear every bit once
+  for (SIZE_T i=0;i<2*n;i++) {
+    SIZE_T f=hand;
+    hand=(hand+1)%n;
+    if (!resident[f] || !filter.CanEvict(f)) {
+      continue;
+    }
+    if (referenced[f]) {
+      referenced[f]=0;
+    } else {
+      return f;
+    }
+  }
+  return NOFRAME;
+}
+
+SIZE_T ClockPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  SIZE_T n=resident.size();
+  SIZE_T first=NOFRAME;
+
+  // The hand stops at the first clear bit; failing that, it clears
+  // them all and stops at the first frame on its second sweep
+  for (SIZE_T i=0;i<n;i++) {
+    SIZE_T f=(hand+i)%n;
+    if (!resident[f] || !filter.CanEvict(f)) {
+      continue;
+    }
+    if (!referenced[f]) {
+      return f;
+    }
+    if (first==NOFRAME) {
+      first=f;
+    }
+  }
+  return first;
+}
+
+void ClockPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  SIZE_T n=resident.size();
+
+  // the hand takes unreferenced frames on its first pass
+  for (BYTE_T pass=0;pass<2;pass++) {
+    for (SIZE_T i=0;i<n && frames.size()<max;i++) {
+      SIZE_T f=(hand+i)%n;
+      if (resident[f] && referenced[f]==pass && filter.CanEvict(f)) {
+	frames.push_back(f);
+      }
+    }
+  }
+}
+
+
+
+TwoQPolicy::TwoQPolicy(const SIZE_T numframes) :
+  a1in(numframes), am(numframes), where(numframes,NOWHERE)
+{
+  kin = numframes/4>0 ? numframes/4 : 1;
+  kout = numframes/2>0 ? numframes/2 : 1;
+}
+
+void TwoQPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (a1out.Contains(blocknum)) {
+    // seen recently enough to be worth keeping
+    a1out.Erase(blocknum);
+    am.PushFront(f);
+    where[f]=AM;
+  } else {
+    a1in.PushFront(f);
+    where[f]=A1IN;
+  }
+}
+
+void TwoQPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  // hits in A1in are deliberately ignored; they are correlated references
+  if (where[f]==AM) {
+    am.Unlink(f);
+    am.PushFront(f);
+  }
+}
+
+void TwoQPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (where[f]==A1IN) {
+    a1in.Unlink(f);
+    a1out.PushFront(blocknum);
+    while (a1out.Size()>kout) {
+      a1out.PopBack();
+    }
+  } else if (where[f]==AM) {
+    am.Unlink(f);
+  }
+  where[f]=NOWHERE;
+}
+
+SIZE_T TwoQPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  return Peek(blocknum,filter);
+}
+
+SIZE_T TwoQPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  SIZE_T f=NOFRAME;
+
+  if (a1in.Size()>kin || am.Size()==0) {
+    f=a1in.FindVictim(filter);
+  }
+  if (f==NOFRAME) {
+    f=am.FindVictim(filter);
+  }
+  if (f==NOFRAME) {
+    f=a1in.FindVictim(filter);
+  }
+  return f;
+}
+
+void TwoQPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  if (a1in.Size()>kin || am.Size()==0) {
+    a1in.Coldest(max,filter,frames);
+    am.Coldest(max,filter,frames);
+  } else {
+    am.Coldest(max,filter,frames);
+    a1in.Coldest(max,filter,frames);
+  }
+}
+
+
+
+ARCPolicy::ARCPolicy(const SIZE_T numframes) :
+  t1(numframes), t2(numframes), where(numframes,NOWHERE),
+  c(numframes), p(0), adaptedfor(0), adapted(false)
+{}
+
+double ARCPolicy::Target(const SIZE_T blocknum) const
+{
+  if (adapted && adaptedfor==blocknum) {
+    return p;
+  }
+  if (b1.Contains(blocknum)) {
+    double delta = b1.Size()>=b2.Size() ? 1.0 : (double)b2.Size()/(double)b1.Size();
+    return (p+delta<(double)c) ? p+delta : (double)c;
+  } else if (b2.Contains(blocknum)) {
+    double delta = b2.Size()>=b1.Size() ? 1.0 : (double)b1.Size()/(double)b2.Size();
+    return (p-delta>0) ? p-delta : 0;
+  }
+  return p;
+}
+
+void ARCPolicy::Adapt(const SIZE_T blocknum)
+{
+  p=Target(blocknum);
+  adapted=true;
+  adaptedfor=blocknum;
+}
+
+void ARCPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  Adapt(blocknum);
+  adapted=false;
+
+  if (b1.Contains(blocknum) || b2.Contains(blocknum)) {
+    // ghost hit: it has now been seen twice
+    b1.Erase(blocknum);
+    b2.Erase(blocknum);
+    t2.PushFront(f);
+    where[f]=T2;
+  } else {
+    // keep the directories within their bounds
+    if (t1.Size()+b1.Size()>=c && b1.Size()>0) {
+      b1.PopBack();
+    }
+    while (t1.Size()+t2.Size()+b1.Size()+b2.Size()>=2*c && b2.Size()>0) {
+      b2.PopBack();
+    }
+    t1.PushFront(f);
+    where[f]=T1;
+  }
+}
+
+void ARCPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (where[f]==T1) {
+    t1.Unlink(f);
+  } else {
+    t2.Unlink(f);
+  }
+  t2.PushFront(f);
+  where[f]=T2;
+}
+
+void ARCPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (where[f]==T1) {
+    t1.Unlink(f);
+    b1.PushFront(blocknum);
+  } else if (where[f]==T2) {
+    t2.Unlink(f);
+    b2.PushFront(blocknum);
+  }
+  where[f]=NOWHERE;
+  while (b1.Size()>c) {
+    b1.PopBack();
+  }
+  while (b2.Size()>c) {
+    b2.PopBack();
+  }
+}
+
+SIZE_T ARCPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  Adapt(blocknum);
+  return Replace(blocknum,p,filter);
+}
+
+SIZE_T ARCPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  return Replace(blocknum,Target(blocknum),filter);
+}
+
+SIZE_T ARCPolicy::Replace(const SIZE_T blocknum, const double target, const EvictionFilter &filter) const
+{
+  SIZE_T f=NOFRAME;
+
+  if (t1.Size()>0 &&
+      ((double)t1.Size()>target || (b2.Contains(blocknum) && (double)t1.Size()==target))) {
+    f=t1.FindVictim(filter);
+  }
+  if (f==NOFRAME) {
+    f=t2.FindVictim(filter);
+  }
+  if (f==NOFRAME) {
+    f=t1.FindVictim(filter);
+  }
+  return f;
+}
+
+void ARCPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  if ((double)t1.Size()>p) {
+    t1.Coldest(max,filter,frames);
+    t2.Coldest(max,filter,frames);
+  } else {
+    t2.Coldest(max,filter,frames);
+    t1.Coldest(max,filter,frames);
+  }
+}
+
+
+
+LRUKPolicy::LRUKPolicy(const SIZE_T numframes, const SIZE_T kk) :
+  k(kk), now(0), history(numframes), resident(numframes,0)
+{}
+
+LRUKPolicy::KEY LRUKPolicy::KeyOf(const SIZE_T f) const
+{
+  // backward K-distance is infinite (0 here) until there are K references
+  TICK_T kth = history[f].size()>=k ? history[f][k-1] : 0;
+  TICK_T last = history[f].empty() ? 0 : history[f][0];
+
+  return KEY(pair<TICK_T, TICK_T>(kth,last),f);
+}
+
+void LRUKPolicy::Reference(const SIZE_T f)
+{
+  history[f].insert(history[f].begin(),++now);
+  if (history[f].size()>k) {
+    history[f].resize(k);
+  }
+}
+
+void LRUKPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  map<SIZE_T, vector<TICK_T> >::iterator i=retained.find(blocknum);
+
+  if (i!=retained.end()) {
+    history[f]=(*i).second;
+    retained.erase(i);
+    retainedorder.Erase(blocknum);
+  } else {
+    history[f].clear();
+  }
+  Reference(f);
+  resident[f]=1;
+  order.insert(KeyOf(f));
+}
+
+void LRUKPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  order.erase(KeyOf(f));
+  Reference(f);
+  order.insert(KeyOf(f));
+}
+
+void LRUKPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (!resident[f]) {
+    return;
+  }
+  order.erase(KeyOf(f));
+  resident[f]=0;
+
+  // retain the history of a bounded number of evicted blocks
+  retained[blocknum]=history[f];
+  retainedorder.PushFront(blocknum);
+  while (retainedorder.Size()>history.size()) {
+    retained.erase(retainedorder.Back());
+    retainedorder.PopBack();
+  }
+  history[f].clear();
+}
+
+SIZE_T LRUKPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  return Peek(blocknum,filter);
+}
+
+SIZE_T LRUKPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  for (set<KEY>::const_iterator i=order.begin(); i!=order.end(); ++i) {
+    if (filter.CanEvict((*i).second)) {
+      return (*i).second;
+    }
+  }
+  return NOFRAME;
+}
+
+void LRUKPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  for (set<KEY>::const_iterator i=order.begin(); i!=order.end() && frames.size()<max; ++i) {
+    if (filter.CanEvict((*i).second)) {
+      frames.push_back((*i).second);
+    }
+  }
+}
+
+string LRUKPolicy::GetName() const
+{
+  char buf[32];
+  sprintf(buf,"lru-%u",k);
+  return string(buf);
+}
+
+
+
+TinyLFUPolicy::TinyLFUPolicy(const SIZE_T numframes, ReplacementPolicy *in) :
+  inner(in), samples(0), probation(numframes),
+  onprobation(numframes,0), frameblock(numframes,0),
+  rejectnext(false), rejectblock(0)
+{
+  SIZE_T width=16;
+
+  while (width<4*numframes) {
+    width<<=1;
+  }
+  sketch.assign(4*width,0);
+  sketchmask=width-1;
+  samplelimit=10*numframes;
+  maxprobation = numframes/100>0 ? numframes/100 : 1;
+}
+
+TinyLFUPolicy::~TinyLFUPolicy()
+{
+  delete inner;
+}
+
+SIZE_T TinyLFUPolicy::Slot(const SIZE_T blocknum, const SIZE_T row) const
+{
+  // a different multiplicative hash per row
+  static const SIZE_T seeds[4] = { 0x9e3779b1, 0x85ebca77, 0xc2b2ae3d, 0x27d4eb2f };
+  SIZE_T h=(blocknum+row)*seeds[row];
+
+  h^=h>>15;
+  return row*(sketchmask+1)+(h & sketchmask);
+}
+
+void TinyLFUPolicy::Record(const SIZE_T blocknum)
+{
+  for (SIZE_T row=0;row<4;row++) {
+    BYTE_T &count=sketch[Slot(blocknum,row)];
+    if (count<15) {
+      count++;
+    }
+  }
+  // age everything so that old popularity fades
+  if (++samples>=samplelimit) {
+    for (SIZE_T i=0;i<sketch.size();i++) {
+      sketch[i]>>=1;
+    }
+    samples/=2;
+  }
+}
+
+SIZE_T TinyLFUPolicy::Frequency(const SIZE_T blocknum) const
+{
+  SIZE_T freq=15;
+
+  for (SIZE_T row=0;row<4;row++) {
+    SIZE_T count=sketch[Slot(blocknum,row)];
+    if (count<freq) {
+      freq=count;
+    }
+  }
+  return freq;
+}
+
+void TinyLFUPolicy::Admit(const SIZE_T f, const SIZE_T blocknum)
+{
+  Record(blocknum);
+  frameblock[f]=blocknum;
+
+  if (rejectnext && rejectblock==blocknum) {
+    probation.PushFront(f);
+    onprobation[f]=1;
+  } else {
+    inner->Admit(f,blocknum);
+  }
+  rejectnext=false;
+}
+
+void TinyLFUPolicy::Touch(const SIZE_T f, const SIZE_T blocknum)
+{
+  Record(blocknum);
+
+  if (onprobation[f]) {
+    // used again, so it has earned a real place
+    probation.Unlink(f);
+    onprobation[f]=0;
+    inner->Admit(f,blocknum);
+  } else {
+    inner->Touch(f,blocknum);
+  }
+}
+
+void TinyLFUPolicy::Remove(const SIZE_T f, const SIZE_T blocknum)
+{
+  if (onprobation[f]) {
+    probation.Unlink(f);
+    onprobation[f]=0;
+  } else {
+    inner->Remove(f,blocknum);
+  }
+}
+
+bool TinyLFUPolicy::Rejects(const SIZE_T blocknum, const SIZE_T v) const
+{
+  // admitted only if more popular than what it would replace
+  return v==NOFRAME || Frequency(blocknum)<=Frequency(frameblock[v]);
+}
+
+SIZE_T TinyLFUPolicy::ProbationVictim(const SIZE_T v, const EvictionFilter &filter) const
+{
+  // Rejected blocks displace each other once probation is full
+  if (probation.Size()>=maxprobation || v==NOFRAME) {
+    SIZE_T p=probation.FindVictim(filter);
+    if (p!=NOFRAME) {
+      return p;
+    }
+  }
+  return v;
+}
+
+SIZE_T TinyLFUPolicy::Victim(const SIZE_T blocknum, const EvictionFilter &filter)
+{
+  SIZE_T v=inner->Victim(blocknum,filter);
+
+  rejectnext=Rejects(blocknum,v);
+  if (!rejectnext) {
+    return v;
+  }
+  rejectblock=blocknum;
+  return ProbationVictim(v,filter);
+}
+
+SIZE_T TinyLFUPolicy::Peek(const SIZE_T blocknum, const EvictionFilter &filter) const
+{
+  SIZE_T v=inner->Peek(blocknum,filter);
+
+  return Rejects(blocknum,v) ? ProbationVictim(v,filter) : v;
+}
+
+void TinyLFUPolicy::Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const
+{
+  probation.Coldest(max,filter,frames);
+  inner->Coldest(max,filter,frames);
+}
+
+
+
+ReplacementPolicy *ReplacementPolicy::Create(const string &name, const SIZE_T numframes)
+{
+  const string suffix="+tinylfu";
+
+  if (name.size()>suffix.size() &&
+      name.compare(name.size()-suffix.size(),suffix.size(),suffix)==0) {
+    ReplacementPolicy *inner=Create(name.substr(0,name.size()-suffix.size()),numframes);
+    if (inner==0) {
+      return 0;
+    }
+    return new TinyLFUPolicy(numframes,inner);
+  }
+
+  if (name=="lru") {
+    return new LRUPolicy(numframes);
+  } else if (name=="clock") {
+    return new ClockPolicy(numframes);
+  } else if (name=="2q") {
+    return new TwoQPolicy(numframes);
+  } else if (name=="arc") {
+    return new ARCPolicy(numframes);
+  } else if (name.compare(0,4,"lru-")==0 && name.size()>4) {
+    const char *digits=name.c_str()+4;
+    char *end;
+    if (*digits<'0' || *digits>'9') {
+      return 0;
+    }
+    unsigned long k=strtoul(digits,&end,10);
+    if (*end || k<1 || k>LRUKPolicy::MAXK) {
+      return 0;
+    }
+    return new LRUKPolicy(numframes,k);
+  } else {
+    return 0;
+  }
+}
+
+bool ReplacementPolicy::IsValidName(const string &name)
+{
+  ReplacementPolicy *p=Create(name,1);
+
+  if (p) {
+    delete p;
+    return true;
+  } else {
+    return false;
+  }
+}
+
+void ReplacementPolicy::PrintNames(ostream &os)
+{
+  os << "lru, clock, 2q, arc, or lru-K (e.g. lru-2, K up to " << LRUKPolicy::MAXK << "), optionally followed by +tinylfu";
+}
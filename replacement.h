@@ -0,0 +1,284 @@
+#ifndef _replacement
+#define _replacement
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <set>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Tells a replacement policy which frames it may evict right now
+// (for example, pinned frames may not be evicted)
+//
+class EvictionFilter {
+ public:
+  virtual ~EvictionFilter() {}
+  virtual bool CanEvict(const SIZE_T frame) const=0;
+};
+
+
+//
+// Replacement policy for the buffer cache
+//
+// Frames are identified by their index in the cache's frame array.
+// The cache tells the policy about every block that is loaded into
+// a frame (Admit), every further use of a cached block (Touch), and
+// every block that leaves the cache (Remove).  When the cache is
+// full it asks the policy for a frame to evict (Victim), naming the
+// block that it wants to load.  Victim does not remove anything; the
+// cache calls Remove on the frame it actually evicts.  Victim may
+// update the policy's own state as it chooses (a clock hand, say), so
+// a cache that only wants to know what would go uses Peek instead.
+//
+class ReplacementPolicy {
+ public:
+  static const SIZE_T NOFRAME = 0xffffffff;
+
+  virtual ~ReplacementPolicy() {}
+
+  virtual void   Admit(const SIZE_T frame, const SIZE_T blocknum)=0;
+  virtual void   Touch(const SIZE_T frame, const SIZE_T blocknum)=0;
+  virtual void   Remove(const SIZE_T frame, const SIZE_T blocknum)=0;
+  // returns NOFRAME if no frame passes the filter
+  virtual SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter)=0;
+  // The frame Victim would return now, without changing any state
+  virtual SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const=0;
+  // Appends up to max frames that pass the filter, roughly in the
+  // order they would be evicted, without changing any state
+  virtual void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const=0;
+
+  virtual string GetName() const=0;
+
+  // Policies are named as one of
+  //   lru, clock, 2q, arc, lru-K (for example lru-2, K up to LRUKPolicy::MAXK)
+  // optionally followed by +tinylfu to add a TinyLFU admission filter
+  // returns 0 if the name is not recognized
+  static ReplacementPolicy *Create(const string &name, const SIZE_T numframes);
+  static bool IsValidName(const string &name);
+  static void PrintNames(ostream &os);
+};
+
+
+//
+// Intrusive doubly linked list of frames, most recent at the front
+//
+class FrameList {
+ private:
+  vector<SIZE_T> prev, next;
+  SIZE_T head, tail, size;
+ public:
+  FrameList(const SIZE_T numframes=0);
+  void   Resize(const SIZE_T numframes);
+  void   PushFront(const SIZE_T frame);
+  void   Unlink(const SIZE_T frame);
+  SIZE_T Front() const { return head; }
+  SIZE_T Back() const { return tail; }
+  SIZE_T Next(const SIZE_T frame) const { return next[frame]; }
+  SIZE_T Prev(const SIZE_T frame) const { return prev[frame]; }
+  SIZE_T Size() const { return size; }
+  // least recently used frame that passes the filter, or NOFRAME
+  SIZE_T FindVictim(const EvictionFilter &filter) const;
+  // appends frames that pass the filter, least recently used first,
+  // until frames holds max of them
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+};
+
+
+//
+// Bounded list of block numbers that are no longer cached
+// (the "ghost" entries used by 2Q and ARC), most recent at the front
+//
+class GhostList {
+ private:
+  list<SIZE_T> blocks;
+  map<SIZE_T, list<SIZE_T>::iterator> where;
+ public:
+  bool   Contains(const SIZE_T blocknum) const { return where.find(blocknum)!=where.end(); }
+  void   PushFront(const SIZE_T blocknum);
+  void   Erase(const SIZE_T blocknum);
+  SIZE_T Back() const { return blocks.back(); }
+  void   PopBack();
+  void   Clear();
+  SIZE_T Size() const { return where.size(); }
+};
+
+
+class LRUPolicy : public ReplacementPolicy {
+ private:
+  FrameList lru;
+ public:
+  LRUPolicy(const SIZE_T numframes);
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const { return "lru"; }
+};
+
+
+//
+// Second chance: a hand sweeps the frames, clearing reference bits,
+// and evicts the first frame whose bit is already clear
+//
+class ClockPolicy : public ReplacementPolicy {
+ private:
+  vector<BYTE_T> referenced;
+  vector<BYTE_T> resident;
+  SIZE_T hand;
+ public:
+  ClockPolicy(const SIZE_T numframes);
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const { return "clock"; }
+};
+
+
+//
+// Full 2Q (Johnson and Shasha, VLDB 94).  New blocks enter the A1in
+// FIFO; blocks evicted from A1in are remembered in the A1out ghost
+// list, and a miss on a remembered block goes to the Am LRU list.
+// Kin is a quarter of the cache and Kout is half of it.
+//
+class TwoQPolicy : public ReplacementPolicy {
+ private:
+  enum { NOWHERE, A1IN, AM };
+  FrameList a1in, am;
+  GhostList a1out;
+  vector<BYTE_T> where;
+  SIZE_T kin, kout;
+ public:
+  TwoQPolicy(const SIZE_T numframes);
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const { return "2q"; }
+};
+
+
+//
+// Adaptive Replacement Cache (Megiddo and Modha, FAST 03).  T1 holds
+// blocks seen once recently, T2 blocks seen at least twice, and the
+// B1/B2 ghost lists remember what was evicted from each.  Ghost hits
+// move the target size p of T1 toward whichever side is missing.
+//
+class ARCPolicy : public ReplacementPolicy {
+ private:
+  enum { NOWHERE, T1, T2 };
+  FrameList t1, t2;
+  GhostList b1, b2;
+  vector<BYTE_T> where;
+  SIZE_T c;
+  double p;
+  SIZE_T adaptedfor;
+  bool   adapted;
+
+  // The target size of T1 once a miss on blocknum has adapted it
+  double Target(const SIZE_T blocknum) const;
+  void   Adapt(const SIZE_T blocknum);
+  // REPLACE(x, p)
+  SIZE_T Replace(const SIZE_T blocknum, const double target, const EvictionFilter &filter) const;
+ public:
+  ARCPolicy(const SIZE_T numframes);
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const { return "arc"; }
+};
+
+
+//
+// LRU-K (O'Neil, O'Neil, and Weikum, SIGMOD 93).  Evicts the block
+// whose K-th most recent reference is oldest; blocks with fewer than
+// K references go first, in LRU order.  Reference history is kept
+// for as many evicted blocks as there are frames.
+//
+class LRUKPolicy : public ReplacementPolicy {
+ private:
+  typedef unsigned long long TICK_T;
+  typedef pair<pair<TICK_T, TICK_T>, SIZE_T> KEY;
+
+  SIZE_T k;
+  TICK_T now;
+  vector<vector<TICK_T> > history;   // per frame, most recent first
+  vector<BYTE_T> resident;
+  set<KEY> order;
+  map<SIZE_T, vector<TICK_T> > retained;
+  GhostList retainedorder;
+
+  KEY    KeyOf(const SIZE_T frame) const;
+  void   Reference(const SIZE_T frame);
+ public:
+  LRUKPolicy(const SIZE_T numframes, const SIZE_T k);
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const;
+
+  // Largest K accepted by ReplacementPolicy::Create
+  static const SIZE_T MAXK=16;
+};
+
+
+//
+// TinyLFU admission filter (Einziger, Friedman, and Manes, TOS 17)
+// in front of another policy.  Access frequencies are estimated with
+// a 4-bit count-min sketch that is halved every 10 accesses per frame.
+// A missed block is only admitted to the inner policy if it is more
+// popular than the victim the inner policy proposes.  Rejected blocks
+// still need a frame, so they live in a small probation list and
+// replace each other; a hit while on probation promotes the block.
+//
+class TinyLFUPolicy : public ReplacementPolicy {
+ private:
+  ReplacementPolicy *inner;
+  vector<BYTE_T> sketch;
+  SIZE_T sketchmask;
+  SIZE_T samples, samplelimit;
+  FrameList probation;
+  vector<BYTE_T> onprobation;
+  vector<SIZE_T> frameblock;
+  SIZE_T maxprobation;
+  bool   rejectnext;
+  SIZE_T rejectblock;
+
+  SIZE_T Slot(const SIZE_T blocknum, const SIZE_T row) const;
+  void   Record(const SIZE_T blocknum);
+  SIZE_T Frequency(const SIZE_T blocknum) const;
+  // Whether blocknum would be kept out of the inner policy in
+  // favour of v, its victim
+  bool   Rejects(const SIZE_T blocknum, const SIZE_T v) const;
+  SIZE_T ProbationVictim(const SIZE_T v, const EvictionFilter &filter) const;
+ public:
+  TinyLFUPolicy(const SIZE_T numframes, ReplacementPolicy *inner);
+  ~TinyLFUPolicy();
+  void   Admit(const SIZE_T frame, const SIZE_T blocknum);
+  void   Touch(const SIZE_T frame, const SIZE_T blocknum);
+  void   Remove(const SIZE_T frame, const SIZE_T blocknum);
+  SIZE_T Victim(const SIZE_T blocknum, const EvictionFilter &filter);
+  SIZE_T Peek(const SIZE_T blocknum, const EvictionFilter &filter) const;
+  void   Coldest(const SIZE_T max, const EvictionFilter &filter, vector<SIZE_T> &frames) const;
+  string GetName() const { return inner->GetName()+"+tinylfu"; }
+};
+
+#endif
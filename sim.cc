@@ -11,7 +11,9 @@ using namespace std;
 
 void usage()
 {
-  cerr << "usage: sim filestem cachesize < specfile \n";
+  cerr << "usage: sim filestem cachesize [name=value ...] < specfile \n";
+  BufferCacheConfig::PrintUsage(cerr);
+  cerr << "  tagjson=FILE also write the statistics by tag to FILE as JSON\n";
 }
 
 
@@ -20,7 +22,7 @@ int main(int argc, char *argv[])
 
   // CONFORMS to the interface of ref_impl.pl
 
-  if (argc != 3){
+  if (argc < 3){
     usage();
     return 1;
   }
@@ -28,6 +30,20 @@ int main(int argc, char *argv[])
   char *filestem=argv[1];
   SIZE_T cachesize=atoi(argv[2]);
   SIZE_T superblocknum;
+  BufferCacheConfig config;
+  string tagjson;
+
+  for (int i=3;i<argc;i++) {
+    string arg(argv[i]);
+    if (arg.compare(0,8,"tagjson=")==0) {
+      tagjson=arg.substr(8);
+      continue;
+    }
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      return 1;
+    }
+  }
 
   FILE *file; 
   char line[1024];
@@ -37,8 +53,8 @@ int main(int argc, char *argv[])
   // We'll connect to the btree only once and then
   // run lots of operations
   // so we need to do this outside the loop
-  DiskSystem disk(filestem);
-  BufferCache cache(&disk,cachesize);
+  OpenDisk disk(filestem);
+  BufferCache cache(disk,cachesize,config);
   // will be set on init
   BTreeIndex *btree;
 
@@ -58,6 +74,11 @@ int main(int argc, char *argv[])
     istrstream is(line2.c_str(),line2.size());
     is >> action >> key >> value;
 
+    // with cpu=wall, each operation is charged for the time it takes
+    if (action != "DEINIT") {
+      cache.BeginOperation();
+    }
+
     if (action == "INIT") {
       btree = new BTreeIndex(atoi(key.c_str()),atoi(value.c_str()),&cache);
       if ((rc=btree->Attach(0, true))!=ERROR_NOERROR) {
@@ -116,9 +137,63 @@ int main(int argc, char *argv[])
 	} else {
 	  delete btree;
 	  cout << "OK\n";
+	  cerr << "Performance statistics:\n";
+	  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+	  cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+	  cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+	  cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+	  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+	  cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+	  cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+	  cerr << "numprefetches   = "<<cache.GetNumPrefetches()<<endl;
+	  cerr << "numprefetchhits = "<<cache.GetNumPrefetchHits()<<endl;
+	  cerr << "numprefetchwaste= "<<cache.GetNumPrefetchWasted()<<endl;
+	  cerr << "numreadaheads   = "<<cache.GetNumReadAheads()<<endl;
+	  cerr << "numreadaheadhits= "<<cache.GetNumReadAheadHits()<<endl;
+	  cerr << "numreadaheadwaste= "<<cache.GetNumReadAheadWasted()<<endl;
+	  cerr << "numflushes      = "<<cache.GetNumFlushes()<<endl;
+	  cerr << "numwbstalls     = "<<cache.GetNumWritebackStalls()<<endl;
+	  cerr << "wbstalltime     = "<<cache.GetWritebackStallTime()<<endl;
+	  if (cache.GetVictimCache()) {
+	    const VictimCache *v=cache.GetVictimCache();
+	    cerr << "victiminserts   = "<<v->GetNumInserts()<<endl;
+	    cerr << "victimrejects   = "<<v->GetNumRejects()<<endl;
+	    cerr << "victimhits      = "<<v->GetNumHits()<<endl;
+	    cerr << "victimratio     = "<<v->GetCompressionRatio()<<endl;
+	    cerr << "victimsaved     = "<<cache.GetVictimSavedTime()<<endl;
+	  }
+	  if (!config.scheduler.empty()) {
+	    disk->GetScheduler()->PrintStats(cerr);
+	  }
+	  disk->PrintModelStats(cerr);
+	  cerr << endl;
+	  if (config.cpu!="none") {
+	    cerr << "cpu time        = "<<cache.GetCPUTime()<<endl;
+	  }
+	  cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+	  cerr << endl;
+	  cerr << "Statistics by tag:\n";
+	  cache.PrintTagStats(cerr);
+	  if (!tagjson.empty()) {
+	    ofstream json(tagjson.c_str());
+	    if (!json) {
+	      cerr << "Can't write "<<tagjson<<endl;
+	    } else {
+	      cache.PrintTagStats(json,true);
+	    }
+	  }
+	  if (cache.GetMissRatioCurve()) {
+	    cerr << endl;
+	    cerr << "Estimated miss ratio curve (sampling "<<cache.GetMissRatioCurve()->GetRate()<<" of the blocks):\n";
+	    cache.PrintMissRatioCurve(cerr);
+	  }
 	}
       }
     }
+
+    if (action != "DEINIT") {
+      cache.EndOperation();
+    }
   }
     
   fclose(file);
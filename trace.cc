@@ -0,0 +1,98 @@
+#include <string.h>
+
+#include "trace.h"
+
+// The header is the magic string and the size of a record, so a
+// trace from a build with a different layout is refused
+static const char   MAGIC[8] = { 'B','T','R','A','C','E','0','1' };
+static const size_t BUFFERSIZE = 1<<20;
+
+
+TraceWriter::TraceWriter(const string &filename) : opid(0), numrecords(0)
+{
+  uint32_t size=sizeof(TraceRecord);
+
+  if ((file=fopen(filename.c_str(),"w"))==0) {
+    throw GenericException();
+  }
+  setvbuf(file,0,_IOFBF,BUFFERSIZE);
+  if (fwrite(MAGIC,sizeof(MAGIC),1,file)!=1 || fwrite(&size,sizeof(size),1,file)!=1) {
+    fclose(file);
+    throw GenericException();
+  }
+  pthread_mutex_init(&lock,0);
+}
+
+TraceWriter::~TraceWriter()
+{
+  fclose(file);
+  pthread_mutex_destroy(&lock);
+}
+
+void TraceWriter::Record(const TraceEvent event, const SIZE_T blocknum, const SIZE_T numblocks,
+			 const double start, const double end,
+			 const uint8_t flags, const SIZE_T tag, const SIZE_T priority)
+{
+  TraceRecord rec;
+
+  memset(&rec,0,sizeof(rec));
+  rec.blocknum=blocknum;
+  rec.start=start;
+  rec.end=end;
+  rec.numblocks=numblocks;
+  rec.event=event;
+  rec.flags=flags;
+  rec.tag=tag;
+  rec.priority=priority;
+
+  pthread_mutex_lock(&lock);
+  rec.opid=opid;
+  fwrite(&rec,sizeof(rec),1,file);
+  numrecords++;
+  pthread_mutex_unlock(&lock);
+}
+
+void TraceWriter::BeginOperation(const double now)
+{
+  pthread_mutex_lock(&lock);
+  opid++;
+  pthread_mutex_unlock(&lock);
+  Record(TRACE_BEGINOP,0,0,now,now);
+}
+
+SIZE_T TraceWriter::GetNumRecords() const
+{
+  SIZE_T n;
+
+  pthread_mutex_lock((pthread_mutex_t *)&lock);
+  n=numrecords;
+  pthread_mutex_unlock((pthread_mutex_t *)&lock);
+  return n;
+}
+
+
+TraceReader::TraceReader(const string &filename)
+{
+  char     magic[sizeof(MAGIC)];
+  uint32_t size;
+
+  if ((file=fopen(filename.c_str(),"r"))==0) {
+    throw GenericException();
+  }
+  setvbuf(file,0,_IOFBF,BUFFERSIZE);
+  if (fread(magic,sizeof(magic),1,file)!=1 || memcmp(magic,MAGIC,sizeof(MAGIC)) ||
+      fread(&size,sizeof(size),1,file)!=1 || size!=sizeof(TraceRecord)) {
+    fclose(file);
+    throw GenericException();
+  }
+}
+
+TraceReader::~TraceReader()
+{
+  fclose(file);
+}
+
+bool TraceReader::Next(TraceRecord &rec)
+{
+  return fread(&rec,sizeof(rec),1,file)==1;
+}
@@ -0,0 +1,106 @@
+#ifndef _trace
+#define _trace
+
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// A block I/O trace: a short header followed by one fixed size
+// record for each call on the buffer cache and each request the disk
+// serves, in the order they happen.  The buffer cache writes one when
+// given the trace=FILE option, and tracereplay plays the cache's
+// calls back against any disk and cache configuration.
+//
+enum TraceEvent {
+  // Buffer cache calls, timed by the cache's clock
+  TRACE_READ,          // ReadBlock
+  TRACE_WRITE,         // WriteBlock
+  TRACE_READBATCH,     // ReadBlocks of the next numblocks TRACE_READs
+  TRACE_PIN,           // PinBlock
+  TRACE_DIRTY,         // MarkDirty of the block's latest pin
+  TRACE_UNPIN,         // UnpinBlock, with the handle's tag and priority
+  TRACE_PREFETCH,      // PrefetchBlock
+  TRACE_FLUSH,         // FlushBlock
+  TRACE_ALLOCATE,      // NotifyAllocateBlock
+  TRACE_DEALLOCATE,    // NotifyDeallocateBlock
+  TRACE_BEGINSCAN,
+  TRACE_ENDSCAN,
+  TRACE_CHARGE,        // Charge of numblocks events of kind tag
+  TRACE_BEGINOP,       // BeginOperation
+  TRACE_ENDOP,         // EndOperation, numblocks the key comparisons made
+  TRACE_ATTACH,
+  TRACE_DETACH,
+  // Requests the disk served, timed by the disk's clock
+  TRACE_DISKREAD,
+  TRACE_DISKWRITE,
+  NUMTRACEEVENTS
+};
+
+// Flags
+const uint8_t TRACE_HIT       = 0x1;  // the block was cached
+const uint8_t TRACE_OVERWRITE = 0x2;  // a pin for overwriting
+
+struct TraceRecord {
+  uint32_t blocknum;
+  uint32_t opid;         // the operation the record belongs to
+  double   start;        // simulated ms
+  double   end;
+  uint32_t numblocks;
+  uint8_t  event;        // a TraceEvent
+  uint8_t  flags;
+  uint8_t  tag;
+  uint8_t  priority;
+};
+
+
+//
+// Writes a trace, through a large stdio buffer.  Record may be called
+// from any thread.  Operations are numbered from 1 as they begin;
+// records made outside one belong to the last to begin, or to 0
+// before the first.
+//
+class TraceWriter {
+ private:
+  FILE   *file;
+  pthread_mutex_t lock;
+  // Protected by lock
+  uint32_t opid;
+  SIZE_T  numrecords;
+ public:
+  // Throws GenericException if the file can't be created
+  TraceWriter(const string &filename);
+  TraceWriter(const TraceWriter &rhs) { throw GenericException(); }
+  TraceWriter & operator=(const TraceWriter &rhs) { throw GenericException(); return *this; }
+  ~TraceWriter();
+
+  void   Record(const TraceEvent event, const SIZE_T blocknum, const SIZE_T numblocks,
+		const double start, const double end,
+		const uint8_t flags=0, const SIZE_T tag=0, const SIZE_T priority=0);
+  // Starts a new operation and records its beginning
+  void   BeginOperation(const double now);
+  SIZE_T GetNumRecords() const;
+};
+
+
+class TraceReader {
+ private:
+  FILE   *file;
+ public:
+  // Throws GenericException if the file can't be read or isn't a trace
+  TraceReader(const string &filename);
+  TraceReader(const TraceReader &rhs) { throw GenericException(); }
+  TraceReader & operator=(const TraceReader &rhs) { throw GenericException(); return *this; }
+  ~TraceReader();
+
+  // returns false at the end of the trace
+  bool   Next(TraceRecord &rec);
+};
+
+#endif
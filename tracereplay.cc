@@ -0,0 +1,256 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <stdlib.h>
+
+#include "buffercache.h"
+#include "trace.h"
+
+using namespace std;
+
+//
+// Plays the buffer cache calls of a trace (see TraceWriter) back
+// against a disk and cache that may be configured differently from
+// the ones it was recorded with.  The disk requests in the trace are
+// skipped, since the replayed cache and disk make their own.  Blocks
+// are written with zeros, so only the times and counts mean anything,
+// and a victim cache holds far more of them than of real blocks.
+//
+
+void usage()
+{
+  cerr << "usage: tracereplay tracefile filestem cachesize [name=value ...]\n";
+  BufferCacheConfig::PrintUsage(cerr);
+}
+
+static bool IsDiskEvent(const TraceRecord &rec)
+{
+  return rec.event==TRACE_DISKREAD || rec.event==TRACE_DISKWRITE;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (argc<4) {
+    usage();
+    return -1;
+  }
+
+  SIZE_T cachesize=atoi(argv[3]);
+  BufferCacheConfig config;
+
+  for (int i=4;i<argc;i++) {
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      return -1;
+    }
+  }
+
+  TraceReader *reader;
+
+  try {
+    reader=new TraceReader(argv[1]);
+  } catch (GenericException &e) {
+    cerr << "Can't read trace "<<argv[1]<<endl;
+    return -1;
+  }
+
+  OpenDisk disk(argv[2]);
+  BufferCache cache(disk,cachesize,config);
+  Block zeros(cache.GetBlockSize());
+  // The handles pinned on each block, the latest last
+  map<SIZE_T, vector<BlockHandle *> > pinned;
+  TraceRecord rec;
+  bool   more=reader->Next(rec);
+  bool   attached=false;
+  SIZE_T numrecords=0, numops=0;
+  double tracedtime=0;
+  ERROR_T rc=ERROR_NOERROR;
+
+  while (more && rc==ERROR_NOERROR) {
+    if (IsDiskEvent(rec)) {
+      more=reader->Next(rec);
+      continue;
+    }
+    numrecords++;
+    tracedtime=rec.end;
+
+    if (!attached && rec.event!=TRACE_ATTACH) {
+      // a trace begun after its cache was attached
+      if ((rc=cache.Attach())!=ERROR_NOERROR) {
+	break;
+      }
+      attached=true;
+    }
+
+    switch (rec.event) {
+    case TRACE_READ: {
+      Block block;
+      rc=cache.ReadBlock(rec.blocknum,block);
+      break;
+    }
+    case TRACE_WRITE:
+      rc=cache.WriteBlock(rec.blocknum,zeros);
+      break;
+    case TRACE_READBATCH: {
+      // gather the batch's reads, which only disk requests come between
+      vector<SIZE_T> blocknums;
+      vector<Block>  blocks;
+      bool cut=false;
+
+      while (blocknums.size()<rec.numblocks && (more=reader->Next(rec))) {
+	if (IsDiskEvent(rec)) {
+	  continue;
+	}
+	if (rec.event!=TRACE_READ) {
+	  cut=true;
+	  break;
+	}
+	numrecords++;
+	tracedtime=rec.end;
+	blocknums.push_back(rec.blocknum);
+      }
+      rc=cache.ReadBlocks(blocknums,blocks);
+      if (cut) {
+	// another call ended the batch early, and is replayed next
+	continue;
+      }
+      break;
+    }
+    case TRACE_PIN: {
+      BlockHandle *handle=new BlockHandle;
+      rc=cache.PinBlock(rec.blocknum,*handle,(rec.flags & TRACE_OVERWRITE)!=0);
+      if (rc==ERROR_NOERROR) {
+	pinned[rec.blocknum].push_back(handle);
+      } else {
+	delete handle;
+      }
+      break;
+    }
+    case TRACE_DIRTY:
+    case TRACE_UNPIN: {
+      map<SIZE_T, vector<BlockHandle *> >::iterator p=pinned.find(rec.blocknum);
+      if (p==pinned.end()) {
+	cerr << "Block "<<rec.blocknum<<" is not pinned at record "<<numrecords<<endl;
+	rc=ERROR_GENERAL;
+	break;
+      }
+      BlockHandle *handle=p->second.back();
+      if (rec.event==TRACE_DIRTY) {
+	rc=handle->MarkDirty();
+      } else {
+	handle->SetTag(rec.tag);
+	handle->SetPriority(rec.priority);
+	rc=handle->Unpin();
+	delete handle;
+	p->second.pop_back();
+	if (p->second.empty()) {
+	  pinned.erase(p);
+	}
+      }
+      break;
+    }
+    case TRACE_PREFETCH:
+      // whether there is room is up to this cache
+      cache.PrefetchBlock(rec.blocknum);
+      break;
+    case TRACE_FLUSH:
+      rc=cache.FlushBlock(rec.blocknum);
+      break;
+    case TRACE_ALLOCATE:
+      // the disk may not have the trace's blocks free, which
+      // only matters to the bitmap's diagnostics
+      cache.NotifyAllocateBlock(rec.blocknum);
+      break;
+    case TRACE_DEALLOCATE:
+      cache.NotifyDeallocateBlock(rec.blocknum);
+      break;
+    case TRACE_BEGINSCAN:
+      cache.BeginScan();
+      break;
+    case TRACE_ENDSCAN:
+      cache.EndScan();
+      break;
+    case TRACE_CHARGE:
+      if (rec.tag<BufferCache::NUMCOSTEVENTS) {
+	cache.Charge((BufferCache::CostEvent)rec.tag,rec.numblocks);
+      }
+      break;
+    case TRACE_BEGINOP:
+      cache.BeginOperation();
+      numops++;
+      break;
+    case TRACE_ENDOP:
+      // the comparisons were made by the traced program, not here
+      cache.Charge(BufferCache::COST_COMPARE,rec.numblocks);
+      cache.EndOperation();
+      break;
+    case TRACE_ATTACH:
+      if (!attached) {
+	rc=cache.Attach();
+	attached=true;
+      }
+      break;
+    case TRACE_DETACH:
+      rc=cache.Detach();
+      break;
+    default:
+      cerr << "Unknown event "<<(unsigned)rec.event<<" at record "<<numrecords<<endl;
+      rc=ERROR_GENERAL;
+      break;
+    }
+
+    if (rc!=ERROR_NOERROR) {
+      break;
+    }
+    more=reader->Next(rec);
+  }
+
+  delete reader;
+
+  if (rc!=ERROR_NOERROR) {
+    cerr << "Error "<<rc<<" replaying record "<<numrecords<<endl;
+    return -1;
+  }
+
+  // Anything the trace left pinned must be let go before detaching,
+  // which does nothing more if the trace ended with a Detach
+  for (map<SIZE_T, vector<BlockHandle *> >::iterator p=pinned.begin(); p!=pinned.end(); ++p) {
+    for (SIZE_T i=0;i<p->second.size();i++) {
+      p->second[i]->Unpin();
+      delete p->second[i];
+    }
+  }
+  if ((rc=cache.Detach())!=ERROR_NOERROR) {
+    cerr << "Can't detach cache due to error "<<rc<<endl;
+    return -1;
+  }
+
+  cerr << "Replay statistics:\n";
+  cerr << "numrecords      = "<<numrecords<<endl;
+  cerr << "numoperations   = "<<numops<<endl;
+  cerr << "policy          = "<<cache.GetPolicyName()<<endl;
+  cerr << "numallocs       = "<<cache.GetNumAllocs()<<endl;
+  cerr << "numdeallocs     = "<<cache.GetNumDeallocs()<<endl;
+  cerr << "numreads        = "<<cache.GetNumReads()<<endl;
+  cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
+  cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
+  cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "numprefetches   = "<<cache.GetNumPrefetches()<<endl;
+  cerr << "numreadaheads   = "<<cache.GetNumReadAheads()<<endl;
+  cerr << "numflushes      = "<<cache.GetNumFlushes()<<endl;
+  cerr << "numwbstalls     = "<<cache.GetNumWritebackStalls()<<endl;
+  if (!config.scheduler.empty()) {
+    disk->GetScheduler()->PrintStats(cerr);
+  }
+  disk->PrintModelStats(cerr);
+  cerr << endl;
+  if (config.cpu!="none") {
+    cerr << "cpu time        = "<<cache.GetCPUTime()<<endl;
+  }
+  cerr << "traced time     = "<<tracedtime<<endl;
+  cerr << "total time      = "<<cache.GetCurrentTime()<<endl;
+
+  return 0;
+}
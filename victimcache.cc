@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "victimcache.h"
+#include "compress.h"
+
+
+VictimCache::VictimCache(const SIZE_T c, const SIZE_T b) :
+  capacity(c), blocksize(b), used(0), inserts(0), rejects(0), hits(0),
+  rawbytes(0), compressedbytes(0)
+{
+  pthread_mutex_init(&lock,0);
+}
+
+VictimCache::~VictimCache()
+{
+  pthread_mutex_destroy(&lock);
+}
+
+void VictimCache::Erase(map<SIZE_T, list<Entry>::iterator>::iterator i)
+{
+  used-=i->second->data.size();
+  entries.erase(i->second);
+  where.erase(i);
+}
+
+void VictimCache::Insert(const SIZE_T blocknum, const BYTE_T *data)
+{
+  // Compressed before taking the lock, so shards can do it at once.
+  // It's not worth keeping unless it saves a quarter.
+  vector<BYTE_T> compressed(blocksize);
+  SIZE_T len=LZCompress(data,blocksize,&compressed[0],blocksize-blocksize/4);
+
+  pthread_mutex_lock(&lock);
+
+  map<SIZE_T, list<Entry>::iterator>::iterator i=where.find(blocknum);
+
+  if (i!=where.end()) {
+    Erase(i);
+  }
+
+  if (len==0 || len>capacity) {
+    rejects++;
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  entries.push_front(Entry());
+  entries.front().blocknum=blocknum;
+  entries.front().data.assign(compressed.begin(),compressed.begin()+len);
+  where[blocknum]=entries.begin();
+  used+=len;
+  inserts++;
+  rawbytes+=blocksize;
+  compressedbytes+=len;
+
+  while (used>capacity) {
+    Erase(where.find(entries.back().blocknum));
+  }
+
+  pthread_mutex_unlock(&lock);
+}
+
+bool VictimCache::Take(const SIZE_T blocknum, BYTE_T *data)
+{
+  pthread_mutex_lock(&lock);
+
+  map<SIZE_T, list<Entry>::iterator>::iterator i=where.find(blocknum);
+  bool found = i!=where.end();
+
+  if (found) {
+    if (data) {
+      const vector<BYTE_T> &c=i->second->data;
+      found=LZDecompress(&c[0],c.size(),data,blocksize);
+      if (found) {
+	hits++;
+      }
+    }
+    Erase(i);
+  }
+
+  pthread_mutex_unlock(&lock);
+  return found;
+}
+
+void VictimCache::Clear()
+{
+  pthread_mutex_lock(&lock);
+  entries.clear();
+  where.clear();
+  used=0;
+  pthread_mutex_unlock(&lock);
+}
+
+SIZE_T VictimCache::GetNumBlocks() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=where.size();
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+SIZE_T VictimCache::GetBytesUsed() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=used;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+SIZE_T VictimCache::GetNumInserts() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=inserts;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+SIZE_T VictimCache::GetNumRejects() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=rejects;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+SIZE_T VictimCache::GetNumHits() const
+{
+  pthread_mutex_lock(&lock);
+  SIZE_T n=hits;
+  pthread_mutex_unlock(&lock);
+  return n;
+}
+
+double VictimCache::GetCompressionRatio() const
+{
+  pthread_mutex_lock(&lock);
+  double r = compressedbytes>0 ? rawbytes/compressedbytes : 0;
+  pthread_mutex_unlock(&lock);
+  return r;
+}
@@ -0,0 +1,65 @@
+#ifndef _victimcache
+#define _victimcache
+
+#include <vector>
+#include <list>
+#include <map>
+
+#include <pthread.h>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// Second tier for the buffer cache: clean blocks it evicts are kept
+// here compressed (see LZCompress), in at most capacity bytes of
+// compressed data, and given back on a later miss instead of being
+// read from disk.  Blocks that don't shrink by at least a quarter are
+// not kept.  A block is never both here and in the buffer cache, so
+// taking it out on a hit, or when the buffer cache is about to
+// overwrite it, keeps the two consistent.  Space is reclaimed in
+// least recently inserted order.
+//
+// All operations take the tier's own lock, which nests inside the
+// buffer cache's shard latches.
+//
+class VictimCache {
+ private:
+  struct Entry {
+    SIZE_T blocknum;
+    vector<BYTE_T> data;
+  };
+
+  SIZE_T capacity, blocksize;
+  mutable pthread_mutex_t lock;
+  // Protected by lock
+  list<Entry> entries;                          // most recent at the front
+  map<SIZE_T, list<Entry>::iterator> where;
+  SIZE_T used;
+  SIZE_T inserts, rejects, hits;
+  double rawbytes, compressedbytes;
+
+  void   Erase(map<SIZE_T, list<Entry>::iterator>::iterator i);
+ public:
+  VictimCache(const SIZE_T capacity, const SIZE_T blocksize);
+  ~VictimCache();
+
+  // Offers a clean block that is leaving the buffer cache
+  void   Insert(const SIZE_T blocknum, const BYTE_T *data);
+  // Removes the block, decompressing it into data unless data is 0.
+  // returns whether it was here (and decompressed correctly)
+  bool   Take(const SIZE_T blocknum, BYTE_T *data);
+  void   Clear();
+
+  SIZE_T GetCapacity() const { return capacity; }
+  SIZE_T GetNumBlocks() const;
+  SIZE_T GetBytesUsed() const;
+  SIZE_T GetNumInserts() const;
+  SIZE_T GetNumRejects() const;
+  SIZE_T GetNumHits() const;
+  // Uncompressed over compressed size of the blocks kept so far
+  double GetCompressionRatio() const;
+};
+
+#endif
@@ -6,7 +6,8 @@
 
 void usage() 
 {
-  cerr << "usage: writebuffer cachesize filestem blocknum numblocks < data\n";
+  cerr << "usage: writebuffer filestem cachesize blocknum numblocks [name=value ...] < data\n";
+  BufferCacheConfig::PrintUsage(cerr);
 }
 
 int main(int argc, char *argv[])
@@ -18,11 +19,19 @@ int main(int argc, char *argv[])
   SIZE_T cachesize=atoi(argv[2]);
   SIZE_T blocknum=atoi(argv[3]);
   SIZE_T numblocks=atoi(argv[4]);
+  BufferCacheConfig config;
 
-  DiskSystem disk(argv[1]);
-  BufferCache cache(&disk,cachesize);
+  for (int i=5;i<argc;i++) {
+    if (config.Parse(argv[i])!=ERROR_NOERROR) {
+      usage();
+      exit(-1);
+    }
+  }
+
+  OpenDisk disk(argv[1]);
+  BufferCache cache(disk,cachesize,config);
 
-  SIZE_T blocksize = disk.GetBlockSize();
+  SIZE_T blocksize = disk->GetBlockSize();
 
   cache.Attach();
 
@@ -54,6 +63,9 @@ int main(int argc, char *argv[])
   cerr << "numdiskreads    = "<<cache.GetNumDiskReads()<<endl;
   cerr << "numwrites       = "<<cache.GetNumWrites()<<endl;
   cerr << "numdiskwrites   = "<<cache.GetNumDiskWrites()<<endl;
+  cerr << "numflushes      = "<<cache.GetNumFlushes()<<endl;
+  cerr << "numwbstalls     = "<<cache.GetNumWritebackStalls()<<endl;
+  cerr << "wbstalltime     = "<<cache.GetWritebackStallTime()<<endl;
   cerr << endl;
 
   cerr << "total time      = "<<cache.GetCurrentTime()<<endl;